@@ -59,8 +59,50 @@ struct MadtLocalApic
     std::uint32_t flags; // bit0 = enabled
 };
 
+// A CPU whose APIC ID does not fit the 8-bit MadtLocalApic entry.
+struct MadtLocalX2Apic
+{
+    MadtEntryHdr h;
+    std::uint16_t reserved;
+    std::uint32_t x2apic_id;
+    std::uint32_t flags; // bit0 = enabled
+    std::uint32_t acpi_uid;
+};
+
+struct MadtIoApic
+{
+    MadtEntryHdr h;
+    std::uint8_t ioapic_id;
+    std::uint8_t reserved;
+    std::uint32_t address;  // physical MMIO base
+    std::uint32_t gsi_base; // first global system interrupt it serves
+};
+
+// An ISA IRQ wired to a different GSI, or with non-ISA polarity/trigger.
+struct MadtIntSourceOverride
+{
+    MadtEntryHdr h;
+    std::uint8_t bus;    // 0 = ISA
+    std::uint8_t source; // ISA IRQ
+    std::uint32_t gsi;
+    std::uint16_t flags; // MPS INTI flags, see kIntiPolarity*/kIntiTrigger*
+};
+
 #pragma pack(pop)
 
+// MADT entry types.
+constexpr std::uint8_t kMadtLocalApic = 0;
+constexpr std::uint8_t kMadtIoApic = 1;
+constexpr std::uint8_t kMadtIntSourceOverride = 2;
+constexpr std::uint8_t kMadtLocalX2Apic = 9;
+
+// MPS INTI flags: bits 0-1 polarity, bits 2-3 trigger mode; 0 means "as
+// the bus defines" (active high, edge for ISA).
+constexpr std::uint16_t kIntiPolarityMask = 0x3;
+constexpr std::uint16_t kIntiPolarityLow = 0x3;
+constexpr std::uint16_t kIntiTriggerMask = 0xC;
+constexpr std::uint16_t kIntiTriggerLevel = 0xC;
+
 struct Root
 {
     std::uint8_t revision;    // 0 => ACPI 1.0 (RSDT), >=2 => XSDT preferred
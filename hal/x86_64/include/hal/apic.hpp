@@ -4,15 +4,24 @@
 namespace hal::apic
 {
 
+// Uses x2APIC (MSR access, 32-bit IDs) when the CPU has it, xAPIC MMIO at
+// `lapic_phys` otherwise. enable_local() puts each AP in the same mode.
 void init(std::uintptr_t lapic_phys) noexcept;
 void enable_local() noexcept;
 
+bool x2apic() noexcept;
 std::uint32_t lapic_id() noexcept;
 
 void eoi() noexcept;
 void timer_init(std::uint8_t vector, std::uint32_t initial_count, std::uint8_t divide, bool periodic) noexcept;
+// Timer counts per millisecond at `divide`, timed with hal::tsc::delay_us()
+// (so calibrate the TSC first). Leaves the timer stopped.
+std::uint32_t timer_calibrate(std::uint8_t divide) noexcept;
 
 void send_init_ipi(std::uint32_t apic_id) noexcept;
 void send_startup_ipi(std::uint32_t apic_id, std::uint8_t vector) noexcept;
+void send_ipi(std::uint32_t apic_id, std::uint8_t vector) noexcept;
+// One IPI to every other CPU (ICR "all excluding self" shorthand).
+void send_ipi_all_but_self(std::uint8_t vector) noexcept;
 
 } // namespace hal::apic
@@ -0,0 +1,38 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include "hal/acpi.hpp"
+
+namespace hal::ioapic
+{
+
+// I/O APIC driver. Inputs are addressed by global system interrupt (GSI)
+// number across all I/O APICs; every input starts masked.
+
+// Takes the I/O APICs and ISA interrupt source overrides from the MADT and
+// masks every input. Without a MADT the ISA defaults apply.
+void init(const hal::acpi::Madt *madt) noexcept;
+bool present() noexcept;
+// Number of GSIs covered, counting from 0.
+std::uint32_t gsi_count() noexcept;
+
+struct IsaRoute
+{
+    std::uint32_t gsi;
+    bool level;
+    bool active_low;
+};
+
+// Where ISA IRQ `irq` arrives, after the MADT overrides.
+IsaRoute isa_route(std::uint8_t irq) noexcept;
+
+// Points `gsi` at `vector` on the local APIC `apic_id` (fixed delivery,
+// physical destination). The input stays masked. Fails for APIC IDs above
+// 0xFF, which a physical destination cannot name.
+bool route(std::uint32_t gsi, std::uint8_t vector, std::uint32_t apic_id, bool level, bool active_low) noexcept;
+// Retargets a routed input, masking it around the change.
+bool set_destination(std::uint32_t gsi, std::uint32_t apic_id) noexcept;
+void mask(std::uint32_t gsi) noexcept;
+void unmask(std::uint32_t gsi) noexcept;
+
+} // namespace hal::ioapic
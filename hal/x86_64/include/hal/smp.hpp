@@ -1,4 +1,5 @@
 #pragma once
+#include <cstddef>
 #include <cstdint>
 
 namespace hal::smp
@@ -7,12 +8,17 @@ namespace hal::smp
 using ApEntry = void (*)(std::uint32_t apic_id) noexcept;
 using ApicReadyHook = void (*)() noexcept;
 using RegisterCpuHook = void (*)(std::uint32_t apic_id) noexcept;
+// Returns `bytes` of 16-byte aligned memory for an AP's boot stack, which
+// the AP keeps for good, or nullptr.
+using AllocStackHook = void *(*)(std::size_t bytes) noexcept;
 
 struct InitHooks
 {
     ApEntry ap_entry{nullptr};
     ApicReadyHook apic_ready{nullptr};
     RegisterCpuHook register_cpu{nullptr};
+    AllocStackHook alloc_stack{nullptr};
+    std::uint32_t max_cpus{1}; // the boot CPU included
 };
 
 void init(std::uintptr_t mb2_info, const InitHooks &hooks) noexcept;
@@ -0,0 +1,23 @@
+#pragma once
+#include <cstdint>
+
+namespace hal::tsc
+{
+
+// TSC rate, measured against PIT channel 2. Until calibrate() succeeds the
+// rate is assumed to be 3 GHz, so early delays are at least in the right
+// ballpark.
+
+// Times a 10 ms PIT countdown. Returns the TSC rate in kHz and uses it from
+// then on; returns 0 (keeping the old rate) if the PIT did not count.
+std::uint64_t calibrate() noexcept;
+std::uint64_t khz() noexcept;
+
+// CPUID.80000007H:EDX[8]: the TSC runs at a constant rate in every P-, C-
+// and T-state.
+bool invariant() noexcept;
+
+// Busy-waits at least `us` microseconds.
+void delay_us(std::uint64_t us) noexcept;
+
+} // namespace hal::tsc
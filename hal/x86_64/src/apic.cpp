@@ -1,4 +1,5 @@
 #include "hal/apic.hpp"
+#include "hal/tsc.hpp"
 #include <cstddef>
 #include <cstdint>
 
@@ -22,42 +23,68 @@ static inline void wrmsr(std::uint32_t msr, std::uint64_t v) noexcept
     asm volatile("wrmsr" ::"c"(msr), "a"(lo), "d"(hi));
 }
 
-static void enable_apic_msr(std::uintptr_t lapic_phys) noexcept
+constexpr std::uint32_t IA32_APIC_BASE = 0x1B;
+constexpr std::uint64_t kApicBaseEnable = 1ull << 11;
+constexpr std::uint64_t kApicBaseX2 = 1ull << 10;
+
+// x2APIC: the xAPIC register at MMIO offset `reg` is MSR 0x800 + reg / 16.
+constexpr std::uint32_t kX2MsrBase = 0x800;
+constexpr std::uint32_t kX2Icr = 0x830; // 64-bit ICR, destination in the high half
+
+// Set on the BSP before any AP starts; every CPU then runs in the same mode.
+static bool g_x2apic = false;
+
+static bool cpu_has_x2apic() noexcept
 {
-    constexpr std::uint32_t IA32_APIC_BASE = 0x1B;
+    std::uint32_t a = 1, b, c = 0, d;
+    asm volatile("cpuid" : "+a"(a), "=b"(b), "+c"(c), "=d"(d));
+    return c & (1u << 21);
+}
 
+static void enable_apic_msr(std::uintptr_t lapic_phys) noexcept
+{
     auto v = rdmsr(IA32_APIC_BASE);
 
     // Bit 11: APIC Global Enable (must be 1 to use local APIC)
-    v |= (1ull << 11);
-
-    // Bit 10: x2APIC enable. We are using xAPIC MMIO, so keep it 0.
-    v &= ~(1ull << 10);
+    v |= kApicBaseEnable;
 
     // Program base address bits [35:12] if you want to trust MADT.
-    // Keep low 12 bits (flags), replace base.
+    // Keep low 12 bits (flags), replace base. Bit 10 is left as it is:
+    // x2APIC cannot be turned off without disabling the APIC first.
     v = (v & 0xFFFu) | (std::uint64_t(lapic_phys) & 0xFFFFF000ull);
 
     wrmsr(IA32_APIC_BASE, v);
 }
 
+// Switches this CPU's local APIC to x2APIC mode. It has to be enabled in
+// xAPIC mode first (enable_apic_msr or the reset state on APs).
+static void enable_x2apic_msr() noexcept
+{
+    auto v = rdmsr(IA32_APIC_BASE);
+    if ((v & (kApicBaseEnable | kApicBaseX2)) == (kApicBaseEnable | kApicBaseX2))
+        return;
+    wrmsr(IA32_APIC_BASE, v | kApicBaseEnable);
+    wrmsr(IA32_APIC_BASE, v | kApicBaseEnable | kApicBaseX2);
+}
+
 static inline std::uint32_t rd(std::size_t reg) noexcept
 {
+    if (g_x2apic)
+        return static_cast<std::uint32_t>(rdmsr(kX2MsrBase + static_cast<std::uint32_t>(reg / 16)));
     return g_lapic[reg / 4];
 }
 
 static inline void wr(std::size_t reg, std::uint32_t v) noexcept
 {
+    if (g_x2apic)
+    {
+        wrmsr(kX2MsrBase + static_cast<std::uint32_t>(reg / 16), v);
+        return;
+    }
     g_lapic[reg / 4] = v;
     (void)g_lapic[reg / 4]; // flush
 }
 
-static inline void pause_loop(std::uint32_t iters) noexcept
-{
-    for (std::uint32_t i = 0; i < iters; ++i)
-        asm volatile("pause");
-}
-
 static bool wait_delivery(std::uint32_t iters = 2000000) noexcept
 {
     // ICR low bit 12 = Delivery Status (1=send pending) :contentReference[oaicite:3]{index=3}
@@ -70,11 +97,32 @@ static bool wait_delivery(std::uint32_t iters = 2000000) noexcept
     return false;
 }
 
+// Sends one IPI. In x2APIC mode that is a single 64-bit MSR write with no
+// delivery status to poll; the MSR write is not serializing, so a fence
+// orders earlier stores the target may look at.
+static void send_icr(std::uint32_t apic_id, std::uint32_t low) noexcept
+{
+    if (g_x2apic)
+    {
+        asm volatile("mfence; lfence" ::: "memory");
+        wrmsr(kX2Icr, (std::uint64_t(apic_id) << 32) | low);
+        return;
+    }
+    wr(0x310, apic_id << 24);
+    wr(0x300, low);
+    wait_delivery();
+}
+
 void init(std::uintptr_t lapic_phys) noexcept
 {
     enable_apic_msr(lapic_phys);
     g_lapic_phys = lapic_phys;
     g_lapic = reinterpret_cast<volatile std::uint32_t *>(lapic_phys);
+    if (cpu_has_x2apic())
+    {
+        enable_x2apic_msr();
+        g_x2apic = true;
+    }
 
     // SVR (0xF0): bit8 = enable local APIC, low 8 bits = spurious vector
     constexpr std::uint32_t kSpuriousVector = 0xFF;
@@ -83,6 +131,13 @@ void init(std::uintptr_t lapic_phys) noexcept
 
 void enable_local() noexcept
 {
+    if (g_x2apic)
+    {
+        enable_x2apic_msr();
+        constexpr std::uint32_t kSpuriousVector = 0xFF;
+        wr(0xF0, (rd(0xF0) & 0xFFFFFF00u) | kSpuriousVector | 0x100);
+        return;
+    }
     if (!g_lapic && g_lapic_phys)
         g_lapic = reinterpret_cast<volatile std::uint32_t *>(g_lapic_phys);
     if (!g_lapic)
@@ -91,8 +146,16 @@ void enable_local() noexcept
     wr(0xF0, (rd(0xF0) & 0xFFFFFF00u) | kSpuriousVector | 0x100);
 }
 
+bool x2apic() noexcept
+{
+    return g_x2apic;
+}
+
 std::uint32_t lapic_id() noexcept
 {
+    // The x2APIC ID register holds the full 32-bit ID.
+    if (g_x2apic)
+        return rd(0x20);
     return rd(0x20) >> 24;
 }
 
@@ -116,22 +179,40 @@ void timer_init(std::uint8_t vector, std::uint32_t initial_count, std::uint8_t d
     wr(0x380, initial_count);
 }
 
+std::uint32_t timer_calibrate(std::uint8_t divide) noexcept
+{
+    constexpr std::uint64_t kWindowUs = 10'000;
+    wr(0x3E0, divide & 0x0Fu);
+    wr(0x320, 1u << 16); // masked, one-shot
+    wr(0x380, 0xFFFFFFFFu);
+    hal::tsc::delay_us(kWindowUs);
+    std::uint32_t left = rd(0x390); // Current Count
+    wr(0x380, 0);                   // stop
+    return static_cast<std::uint32_t>((0xFFFFFFFFu - left) * 1000ull / kWindowUs);
+}
+
 void send_init_ipi(std::uint32_t apic_id) noexcept
 {
-    wr(0x310, apic_id << 24);
-    wr(0x300, 0x00004500); // INIT :contentReference[oaicite:4]{index=4}
-    wait_delivery();
-    // crude delay ~10ms-ish (no timer yet): make it a bit longer than before
-    pause_loop(5000000);
+    send_icr(apic_id, 0x00004500); // INIT :contentReference[oaicite:4]{index=4}
+    // INIT needs 10 ms to settle before the first SIPI.
+    hal::tsc::delay_us(10'000);
 }
 
 void send_startup_ipi(std::uint32_t apic_id, std::uint8_t vector) noexcept
 {
-    wr(0x310, apic_id << 24);
-    wr(0x300, 0x00004600 | vector); // SIPI :contentReference[oaicite:5]{index=5}
-    wait_delivery();
-    // spec wants ~200us between SIPIs; this is crude but OK for now
-    pause_loop(200000);
+    send_icr(apic_id, 0x00004600 | vector); // SIPI :contentReference[oaicite:5]{index=5}
+    // The MP spec wants 200 us after each SIPI.
+    hal::tsc::delay_us(200);
+}
+
+void send_ipi(std::uint32_t apic_id, std::uint8_t vector) noexcept
+{
+    send_icr(apic_id, 0x00004000 | vector); // fixed delivery, level assert
+}
+
+void send_ipi_all_but_self(std::uint8_t vector) noexcept
+{
+    send_icr(0, 0x000C4000 | vector); // shorthand 11b: all excluding self
 }
 
 } // namespace hal::apic
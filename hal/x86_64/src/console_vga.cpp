@@ -1,5 +1,5 @@
 #include "hal/console.hpp"
-#include <atomic>
+#include "kern/sync/spinlock.hpp"
 #include <cstddef>
 #include <cstdint>
 
@@ -13,7 +13,9 @@ volatile std::uint16_t *const kVgaBuffer = reinterpret_cast<volatile std::uint16
 
 std::size_t g_row = 0;
 std::size_t g_col = 0;
-std::atomic_flag g_console_lock = ATOMIC_FLAG_INIT;
+// Interrupt handlers print too, so hold it with interrupts off.
+kern::sync::TicketLock g_console_lock{"console"};
+using Guard = kern::sync::IrqSpinGuard<kern::sync::TicketLock>;
 
 // Light gray on black.
 constexpr std::uint8_t kAttr = 0x07;
@@ -72,29 +74,6 @@ void put_char(char ch) noexcept
     }
 }
 
-static inline std::uint64_t irq_save() noexcept
-{
-    std::uint64_t flags = 0;
-    asm volatile("pushfq; pop %0; cli" : "=r"(flags) :: "memory");
-    return flags;
-}
-
-static inline void irq_restore(std::uint64_t flags) noexcept
-{
-    asm volatile("push %0; popfq" : : "r"(flags) : "memory", "cc");
-}
-
-static inline void lock() noexcept
-{
-    while (g_console_lock.test_and_set(std::memory_order_acquire))
-        asm volatile("pause");
-}
-
-static inline void unlock() noexcept
-{
-    g_console_lock.clear(std::memory_order_release);
-}
-
 } // namespace
 
 namespace hal::console
@@ -102,8 +81,7 @@ namespace hal::console
 
 void clear() noexcept
 {
-    auto flags = irq_save();
-    lock();
+    Guard guard(g_console_lock);
     for (std::size_t r = 0; r < kVgaHeight; ++r)
     {
         for (std::size_t c = 0; c < kVgaWidth; ++c)
@@ -113,64 +91,50 @@ void clear() noexcept
     }
     g_row = 0;
     g_col = 0;
-    unlock();
-    irq_restore(flags);
 }
 
 void write(const char *s) noexcept
 {
     if (!s)
         return;
-    auto flags = irq_save();
-    lock();
+    Guard guard(g_console_lock);
     while (*s)
     {
         put_char(*s++);
     }
-    unlock();
-    irq_restore(flags);
 }
 
 void write(const char *s, std::size_t n) noexcept
 {
     if (!s)
         return;
-    auto flags = irq_save();
-    lock();
+    Guard guard(g_console_lock);
     for (std::size_t i = 0; i < n; ++i)
     {
         put_char(s[i]);
     }
-    unlock();
-    irq_restore(flags);
 }
 
 template <> void write_hex<std::uint64_t>(std::uint64_t v) noexcept
 {
-    auto flags = irq_save();
-    lock();
+    Guard guard(g_console_lock);
     const char *hex = "0123456789ABCDEF";
     for (int i = 15; i >= 0; --i)
     {
         char c = hex[(v >> (i * 4)) & 0xF];
         put_char(c);
     }
-    unlock();
-    irq_restore(flags);
 }
 
 template <> void write_hex<std::uint32_t>(std::uint32_t v) noexcept
 {
-    auto flags = irq_save();
-    lock();
+    Guard guard(g_console_lock);
     const char *hex = "0123456789ABCDEF";
     for (int i = 7; i >= 0; --i)
     {
         char c = hex[(v >> (i * 4)) & 0xF];
         put_char(c);
     }
-    unlock();
-    irq_restore(flags);
 }
 
 } // namespace hal::console
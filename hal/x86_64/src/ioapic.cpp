@@ -0,0 +1,199 @@
+#include "hal/ioapic.hpp"
+#include "hal/console.hpp"
+#include "kern/sync/spinlock.hpp"
+#include <cstddef>
+#include <cstdint>
+
+namespace hal::ioapic
+{
+
+constexpr std::size_t kMaxIoApics = 8;
+constexpr std::size_t kIsaIrqs = 16;
+
+// Register indices, through IOREGSEL (base + 0x00) and IOWIN (base + 0x10).
+constexpr std::uint32_t kRegVersion = 0x01;
+constexpr std::uint32_t kRegRedirBase = 0x10;
+
+// Redirection entry, low dword.
+constexpr std::uint32_t kRedirActiveLow = 1u << 13;
+constexpr std::uint32_t kRedirLevel = 1u << 15;
+constexpr std::uint32_t kRedirMasked = 1u << 16;
+// Physical destinations are 8 bits wide; higher x2APIC IDs need interrupt
+// remapping, which we do not set up.
+constexpr std::uint32_t kMaxDestination = 0xFF;
+
+struct IoApic
+{
+    volatile std::uint32_t *mmio;
+    std::uint32_t gsi_base;
+    std::uint32_t inputs;
+};
+
+static IoApic g_ioapics[kMaxIoApics] = {};
+static std::size_t g_count = 0;
+static IsaRoute g_isa[kIsaIrqs] = {};
+
+// The select/window pair is one access; interrupt handlers may reroute.
+static kern::sync::TicketLock g_lock{"ioapic"};
+using Guard = kern::sync::IrqSpinGuard<kern::sync::TicketLock>;
+
+static std::uint32_t rd(const IoApic &io, std::uint32_t reg) noexcept
+{
+    io.mmio[0] = reg;
+    return io.mmio[4];
+}
+
+static void wr(const IoApic &io, std::uint32_t reg, std::uint32_t v) noexcept
+{
+    io.mmio[0] = reg;
+    io.mmio[4] = v;
+}
+
+// The I/O APIC serving `gsi` and the input index on it, or nullptr.
+static const IoApic *find(std::uint32_t gsi, std::uint32_t &pin) noexcept
+{
+    for (std::size_t i = 0; i < g_count; ++i)
+    {
+        const IoApic &io = g_ioapics[i];
+        if (gsi >= io.gsi_base && gsi - io.gsi_base < io.inputs)
+        {
+            pin = gsi - io.gsi_base;
+            return &io;
+        }
+    }
+    return nullptr;
+}
+
+static void add_ioapic(const hal::acpi::MadtIoApic *e) noexcept
+{
+    if (g_count == kMaxIoApics)
+        return;
+    IoApic &io = g_ioapics[g_count];
+    io.mmio = reinterpret_cast<volatile std::uint32_t *>(static_cast<std::uintptr_t>(e->address));
+    io.gsi_base = e->gsi_base;
+    io.inputs = ((rd(io, kRegVersion) >> 16) & 0xFF) + 1;
+    for (std::uint32_t pin = 0; pin < io.inputs; ++pin)
+    {
+        wr(io, kRegRedirBase + pin * 2, kRedirMasked);
+        wr(io, kRegRedirBase + pin * 2 + 1, 0);
+    }
+    ++g_count;
+}
+
+static void add_override(const hal::acpi::MadtIntSourceOverride *e) noexcept
+{
+    if (e->bus != 0 || e->source >= kIsaIrqs)
+        return;
+    IsaRoute &r = g_isa[e->source];
+    r.gsi = e->gsi;
+    r.active_low = (e->flags & hal::acpi::kIntiPolarityMask) == hal::acpi::kIntiPolarityLow;
+    r.level = (e->flags & hal::acpi::kIntiTriggerMask) == hal::acpi::kIntiTriggerLevel;
+}
+
+void init(const hal::acpi::Madt *madt) noexcept
+{
+    for (std::size_t irq = 0; irq < kIsaIrqs; ++irq)
+        g_isa[irq] = IsaRoute{static_cast<std::uint32_t>(irq), false, false};
+    if (!madt)
+        return;
+
+    std::uintptr_t p = reinterpret_cast<std::uintptr_t>(madt) + sizeof(hal::acpi::Madt);
+    std::uintptr_t e = reinterpret_cast<std::uintptr_t>(madt) + madt->hdr.length;
+    while (p + sizeof(hal::acpi::MadtEntryHdr) <= e)
+    {
+        auto *h = reinterpret_cast<const hal::acpi::MadtEntryHdr *>(p);
+        if (h->length < sizeof(hal::acpi::MadtEntryHdr) || p + h->length > e)
+            break;
+        if (h->type == hal::acpi::kMadtIoApic && h->length >= sizeof(hal::acpi::MadtIoApic))
+            add_ioapic(reinterpret_cast<const hal::acpi::MadtIoApic *>(p));
+        else if (h->type == hal::acpi::kMadtIntSourceOverride &&
+                 h->length >= sizeof(hal::acpi::MadtIntSourceOverride))
+            add_override(reinterpret_cast<const hal::acpi::MadtIntSourceOverride *>(p));
+        p += h->length;
+    }
+
+    hal::console::write("IOAPIC: ");
+    hal::console::write_hex<std::uint32_t>(static_cast<std::uint32_t>(g_count));
+    hal::console::write(" found, ");
+    hal::console::write_hex<std::uint32_t>(gsi_count());
+    hal::console::write(" GSIs\n");
+}
+
+bool present() noexcept
+{
+    return g_count != 0;
+}
+
+std::uint32_t gsi_count() noexcept
+{
+    std::uint32_t n = 0;
+    for (std::size_t i = 0; i < g_count; ++i)
+    {
+        std::uint32_t end = g_ioapics[i].gsi_base + g_ioapics[i].inputs;
+        if (end > n)
+            n = end;
+    }
+    return n;
+}
+
+IsaRoute isa_route(std::uint8_t irq) noexcept
+{
+    if (irq >= kIsaIrqs)
+        return IsaRoute{irq, false, false};
+    return g_isa[irq];
+}
+
+bool route(std::uint32_t gsi, std::uint8_t vector, std::uint32_t apic_id, bool level, bool active_low) noexcept
+{
+    std::uint32_t pin;
+    const IoApic *io = find(gsi, pin);
+    if (!io || apic_id > kMaxDestination)
+        return false;
+    std::uint32_t low = vector | kRedirMasked;
+    if (level)
+        low |= kRedirLevel;
+    if (active_low)
+        low |= kRedirActiveLow;
+    Guard guard(g_lock);
+    wr(*io, kRegRedirBase + pin * 2, kRedirMasked);
+    wr(*io, kRegRedirBase + pin * 2 + 1, apic_id << 24);
+    wr(*io, kRegRedirBase + pin * 2, low);
+    return true;
+}
+
+bool set_destination(std::uint32_t gsi, std::uint32_t apic_id) noexcept
+{
+    std::uint32_t pin;
+    const IoApic *io = find(gsi, pin);
+    if (!io || apic_id > kMaxDestination)
+        return false;
+    Guard guard(g_lock);
+    std::uint32_t low = rd(*io, kRegRedirBase + pin * 2);
+    wr(*io, kRegRedirBase + pin * 2, low | kRedirMasked);
+    wr(*io, kRegRedirBase + pin * 2 + 1, apic_id << 24);
+    wr(*io, kRegRedirBase + pin * 2, low);
+    return true;
+}
+
+static void set_mask(std::uint32_t gsi, bool masked) noexcept
+{
+    std::uint32_t pin;
+    const IoApic *io = find(gsi, pin);
+    if (!io)
+        return;
+    Guard guard(g_lock);
+    std::uint32_t low = rd(*io, kRegRedirBase + pin * 2);
+    wr(*io, kRegRedirBase + pin * 2, masked ? low | kRedirMasked : low & ~kRedirMasked);
+}
+
+void mask(std::uint32_t gsi) noexcept
+{
+    set_mask(gsi, true);
+}
+
+void unmask(std::uint32_t gsi) noexcept
+{
+    set_mask(gsi, false);
+}
+
+} // namespace hal::ioapic
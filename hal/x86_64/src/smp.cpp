@@ -3,6 +3,8 @@
 #include "hal/acpi.hpp"
 #include "hal/apic.hpp"
 #include "hal/console.hpp"
+#include "hal/ioapic.hpp"
+#include "hal/tsc.hpp"
 #include <atomic>
 #include <cstddef>
 #include <cstdint>
@@ -28,6 +30,7 @@ struct ApBootParams
 
 constexpr std::uintptr_t kTrampolinePhys = 0x7000;
 constexpr std::uintptr_t kParamsPhys = 0x8000;
+constexpr std::size_t kApStackSize = 16 * 1024;
 
 static std::atomic_uint g_ap_online = 0;
 static hal::smp::InitHooks g_hooks = {};
@@ -40,12 +43,6 @@ static void mem_copy(std::uintptr_t dst, std::uintptr_t src, std::size_t n)
         d[i] = s[i];
 }
 
-static void udelay()
-{
-    for (int i = 0; i < 200000; ++i)
-        asm volatile("pause" ::: "memory");
-}
-
 static std::uintptr_t read_cr3()
 {
     std::uintptr_t v;
@@ -72,6 +69,49 @@ extern "C" void hal_smp_ap_entry(std::uint32_t apic_id) noexcept
         asm volatile("hlt");
 }
 
+namespace
+{
+
+// Starts one AP (sequentially, so the params block can be reused). Its boot
+// stack becomes its idle thread's, so each AP gets its own from the hook.
+// Returns 1 if it was started, 0 if skipped.
+static std::uint32_t start_ap(ApBootParams *params, std::uint32_t apic_id, std::uint32_t bsp_id,
+                              std::uint32_t started) noexcept
+{
+    if (apic_id == bsp_id || started + 1 >= g_hooks.max_cpus)
+        return 0;
+    auto *stack = static_cast<std::uint8_t *>(g_hooks.alloc_stack(kApStackSize));
+    if (!stack)
+    {
+        hal::console::write("SMP: no stack for AP apic_id=");
+        hal::console::write_hex<std::uint32_t>(apic_id);
+        hal::console::write("\n");
+        return 0;
+    }
+    params->stack_top = reinterpret_cast<std::uint64_t>(stack + kApStackSize);
+    params->apic_id = apic_id;
+
+    // INIT, then two SIPIs; the delays the MP spec asks for are in there.
+    hal::apic::send_init_ipi(apic_id);
+    std::uint8_t vec = static_cast<std::uint8_t>(kTrampolinePhys >> 12);
+    hal::apic::send_startup_ipi(apic_id, vec);
+    hal::apic::send_startup_ipi(apic_id, vec);
+
+    // Wait up to 100 ms for the AP online flag.
+    for (int spin = 0; spin < 10'000; ++spin)
+    {
+        if (g_ap_online.load(std::memory_order_relaxed) == started + 1)
+            break;
+        hal::tsc::delay_us(10);
+    }
+
+    if (g_hooks.register_cpu)
+        g_hooks.register_cpu(apic_id);
+    return 1;
+}
+
+} // namespace
+
 namespace hal::smp
 {
 
@@ -88,6 +128,7 @@ void init(std::uintptr_t mb2_info, const InitHooks &hooks) noexcept
         hal::console::write("SMP: MADT not found, staying single-core.\n");
         // Fallback: try default LAPIC base so the timer can still work.
         hal::apic::init(0xFEE00000);
+        hal::ioapic::init(nullptr);
         if (g_hooks.apic_ready)
             g_hooks.apic_ready();
         if (g_hooks.register_cpu)
@@ -96,15 +137,16 @@ void init(std::uintptr_t mb2_info, const InitHooks &hooks) noexcept
     }
 
     hal::apic::init(madt->lapic_addr);
+    hal::ioapic::init(madt);
     if (g_hooks.apic_ready)
         g_hooks.apic_ready();
     auto bsp_id = hal::apic::lapic_id();
     if (g_hooks.register_cpu)
         g_hooks.register_cpu(bsp_id);
 
-    if (!g_hooks.ap_entry)
+    if (!g_hooks.ap_entry || !g_hooks.alloc_stack)
     {
-        hal::console::write("SMP: no AP entry, staying single-core.\n");
+        hal::console::write("SMP: no AP entry or stack allocator, staying single-core.\n");
         return;
     }
 
@@ -129,40 +171,19 @@ void init(std::uintptr_t mb2_info, const InitHooks &hooks) noexcept
         if (h->length < sizeof(hal::acpi::MadtEntryHdr))
             break;
 
-        if (h->type == 0 && h->length >= sizeof(hal::acpi::MadtLocalApic))
+        if (h->type == hal::acpi::kMadtLocalApic && h->length >= sizeof(hal::acpi::MadtLocalApic))
         {
             auto *la = reinterpret_cast<const hal::acpi::MadtLocalApic *>(p);
-            if ((la->flags & 1u) && la->apic_id != bsp_id)
-            {
-                // Start AP sequentially (safe temp stack usage)
-                static std::uint8_t ap_stack_pool[8][16 * 1024] = {};
-                if (started < 8)
-                {
-                    params->stack_top =
-                        reinterpret_cast<std::uint64_t>(&ap_stack_pool[started][sizeof(ap_stack_pool[0])]);
-                    params->apic_id = la->apic_id;
-
-                    hal::apic::send_init_ipi(la->apic_id);
-                    udelay();
-
-                    std::uint8_t vec = static_cast<std::uint8_t>(kTrampolinePhys >> 12);
-                    hal::apic::send_startup_ipi(la->apic_id, vec);
-                    udelay();
-                    hal::apic::send_startup_ipi(la->apic_id, vec);
-
-                    // Wait for AP online flag (simple, with timeout later)
-                    for (int spin = 0; spin < 2000000; ++spin)
-                    {
-                        if (g_ap_online.load(std::memory_order_relaxed) == started + 1)
-                            break;
-                        asm volatile("pause" ::: "memory");
-                    }
-
-                    if (g_hooks.register_cpu)
-                        g_hooks.register_cpu(la->apic_id);
-                    ++started;
-                }
-            }
+            if (la->flags & 1u)
+                started += start_ap(params, la->apic_id, bsp_id, started);
+        }
+        else if (h->type == hal::acpi::kMadtLocalX2Apic && h->length >= sizeof(hal::acpi::MadtLocalX2Apic))
+        {
+            // IDs below 0xFF are listed as type 0 as well; larger ones can
+            // only be reached in x2APIC mode.
+            auto *la = reinterpret_cast<const hal::acpi::MadtLocalX2Apic *>(p);
+            if ((la->flags & 1u) && la->x2apic_id >= 0xFF && hal::apic::x2apic())
+                started += start_ap(params, la->x2apic_id, bsp_id, started);
         }
         p += h->length;
     }
@@ -0,0 +1,84 @@
+#include "hal/tsc.hpp"
+#include <atomic>
+#include <cstdint>
+
+namespace hal::tsc
+{
+
+constexpr std::uint64_t kPitHz = 1193182;
+constexpr std::uint64_t kCalibrateMs = 10;
+// inb() costs about a microsecond, so this gives up after roughly a second.
+constexpr std::uint32_t kMaxPolls = 1'000'000;
+
+static std::atomic<std::uint64_t> g_khz = 3'000'000;
+
+static inline std::uint64_t rdtsc() noexcept
+{
+    std::uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return (std::uint64_t(hi) << 32) | lo;
+}
+
+static inline std::uint8_t inb(std::uint16_t port) noexcept
+{
+    std::uint8_t v;
+    asm volatile("inb %1, %0" : "=a"(v) : "Nd"(port));
+    return v;
+}
+
+static inline void outb(std::uint16_t port, std::uint8_t v) noexcept
+{
+    asm volatile("outb %0, %1" : : "a"(v), "Nd"(port));
+}
+
+std::uint64_t calibrate() noexcept
+{
+    // Port 0x61: bit 0 gates channel 2, bit 1 drives the speaker (off),
+    // bit 5 reads back channel 2's output.
+    outb(0x61, static_cast<std::uint8_t>((inb(0x61) & ~0x02) | 0x01));
+    // Channel 2, lobyte/hibyte, mode 0: output goes high at terminal count.
+    outb(0x43, 0xB0);
+    constexpr std::uint32_t latch = kPitHz * kCalibrateMs / 1000;
+    outb(0x42, latch & 0xFF);
+    std::uint64_t start = rdtsc();
+    outb(0x42, latch >> 8); // counting starts here
+
+    std::uint32_t polls = 0;
+    while (!(inb(0x61) & 0x20))
+    {
+        if (++polls == kMaxPolls)
+            return 0;
+    }
+    std::uint64_t khz = (rdtsc() - start) / kCalibrateMs;
+    if (polls < 2 || !khz)
+        return 0; // output was already high: no PIT behind the port
+    g_khz.store(khz, std::memory_order_relaxed);
+    return khz;
+}
+
+std::uint64_t khz() noexcept
+{
+    return g_khz.load(std::memory_order_relaxed);
+}
+
+bool invariant() noexcept
+{
+    std::uint32_t a = 0x80000000, b, c = 0, d;
+    asm volatile("cpuid" : "+a"(a), "=b"(b), "+c"(c), "=d"(d));
+    if (a < 0x80000007)
+        return false;
+    a = 0x80000007;
+    c = 0;
+    asm volatile("cpuid" : "+a"(a), "=b"(b), "+c"(c), "=d"(d));
+    return d & (1u << 8);
+}
+
+void delay_us(std::uint64_t us) noexcept
+{
+    std::uint64_t cycles = us * khz() / 1000;
+    std::uint64_t start = rdtsc();
+    while (rdtsc() - start < cycles)
+        asm volatile("pause" ::: "memory");
+}
+
+} // namespace hal::tsc
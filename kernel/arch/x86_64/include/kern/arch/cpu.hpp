@@ -0,0 +1,41 @@
+#pragma once
+#include <cstdint>
+
+namespace kern::arch
+{
+
+// Reads the time-stamp counter. Not serializing; good enough for accounting.
+inline std::uint64_t rdtsc() noexcept
+{
+    std::uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return (std::uint64_t(hi) << 32) | lo;
+}
+
+inline std::uint64_t rdmsr(std::uint32_t msr) noexcept
+{
+    std::uint32_t lo, hi;
+    asm volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return (std::uint64_t(hi) << 32) | lo;
+}
+
+inline void wrmsr(std::uint32_t msr, std::uint64_t v) noexcept
+{
+    asm volatile("wrmsr" ::"c"(msr), "a"(std::uint32_t(v)), "d"(std::uint32_t(v >> 32)));
+}
+
+constexpr std::uint32_t kMsrGsBase = 0xC0000101;
+
+struct CpuidRegs
+{
+    std::uint32_t eax, ebx, ecx, edx;
+};
+
+inline CpuidRegs cpuid(std::uint32_t leaf, std::uint32_t subleaf = 0) noexcept
+{
+    CpuidRegs r{};
+    asm volatile("cpuid" : "=a"(r.eax), "=b"(r.ebx), "=c"(r.ecx), "=d"(r.edx) : "a"(leaf), "c"(subleaf));
+    return r;
+}
+
+} // namespace kern::arch
@@ -6,23 +6,41 @@ namespace kern::interrupts
 {
 
 constexpr std::uint8_t kTimerVector = 0x20;
+// Scheduler tick, and the local APIC timer divider it is programmed with
+// (0x3 = divide by 16).
+constexpr std::uint64_t kTickNs = 1'000'000;
+constexpr std::uint8_t kTimerDivide = 0x3;
+constexpr std::uint8_t kReschedVector = 0xF0;
+constexpr std::uint8_t kCallVector = 0xF1; // kern::smp::call()
 constexpr std::uint8_t kSpuriousVector = 0xFF;
+// Vectors kern::irq hands out for device interrupts.
+constexpr std::uint8_t kFirstDeviceVector = 0x30;
+constexpr std::uint8_t kLastDeviceVector = 0xEF;
+// Software-interrupt targets for measure_entry_cost(): the common entry,
+// which isr_dispatch() returns from before any hook, and an empty lean entry.
+constexpr std::uint8_t kProbeVector = 0xFD;
+constexpr std::uint8_t kProbeFastVector = 0xFE;
 
+// Built by the entry code in interrupts.S. The timer and reschedule entries
+// fill the callee-saved half only when they preempt, so their handlers must
+// not read it.
 struct Frame
 {
+    // Callee-saved.
     std::uint64_t r15;
     std::uint64_t r14;
     std::uint64_t r13;
     std::uint64_t r12;
+    std::uint64_t rbp;
+    std::uint64_t rbx;
+
+    // Caller-saved.
     std::uint64_t r11;
     std::uint64_t r10;
     std::uint64_t r9;
     std::uint64_t r8;
-
     std::uint64_t rdi;
     std::uint64_t rsi;
-    std::uint64_t rbp;
-    std::uint64_t rbx;
     std::uint64_t rdx;
     std::uint64_t rcx;
     std::uint64_t rax;
@@ -37,4 +55,14 @@ struct Frame
     std::uint64_t ss;
 };
 
+// Average cycles of one `int`/`iretq` round trip through each entry path,
+// with interrupts off.
+struct EntryCost
+{
+    std::uint64_t full; // common stub, full register save
+    std::uint64_t lean; // timer-style entry that does not preempt
+};
+
+EntryCost measure_entry_cost() noexcept;
+
 } // namespace kern::interrupts
@@ -0,0 +1,97 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include "kern/arch/sched.hpp"
+
+namespace kern::trace
+{
+struct Ring;
+} // namespace kern::trace
+
+namespace kern::deferred
+{
+struct Queue;
+} // namespace kern::deferred
+
+namespace kern::rcu
+{
+struct CpuState;
+} // namespace kern::rcu
+
+namespace kern::irqstat
+{
+struct CpuStats;
+} // namespace kern::irqstat
+
+namespace kern::smp
+{
+struct CallQueue;
+} // namespace kern::smp
+
+namespace kern::percpu
+{
+
+// One block per logical CPU, cache-line aligned so CPUs never share a line of
+// each other's hot state. IA32_GS_BASE of each CPU points at its own block.
+struct alignas(64) CpuBlock
+{
+    CpuBlock *self{nullptr}; // must stay first: this_cpu() loads gs:[0]
+
+    // Preemption control (kern::sched::preempt_disable()). The count is
+    // changed with one gs-relative instruction, so the thread cannot move to
+    // another CPU halfway; keep it at kPreemptCountOffset.
+    std::uint32_t preempt_count{0};
+    std::uint32_t need_resched{0}; // a preemption was deferred
+    std::uint64_t preempt_deferred{0};
+
+    std::size_t index{0};
+    std::uint32_t apic_id{0};
+    // Added to this CPU's TSC to get the boot CPU's (kern::time::sync_cpu()).
+    std::int64_t tsc_offset{0};
+
+    kern::sched::CpuSched sched{};
+
+    // Lazy FPU: thread whose SIMD state the registers may hold, and whether
+    // CR0.TS is currently set (cached to skip redundant CR0 writes).
+    kern::sched::Thread *fpu_owner{nullptr};
+    bool fpu_ts{false};
+
+    // Scheduler trace ring (sched_trace builds only).
+    kern::trace::Ring *trace_ring{nullptr};
+
+    // Deferred work queued by interrupt handlers (kern/deferred.hpp).
+    kern::deferred::Queue *deferred{nullptr};
+
+    // Grace-period state and pending callbacks (kern/rcu.hpp).
+    kern::rcu::CpuState *rcu{nullptr};
+
+    // Interrupt counters and histograms (irq_stats builds only).
+    kern::irqstat::CpuStats *irq_stats{nullptr};
+
+    // Cross-CPU call queue and request slots (kern/smp.hpp).
+    kern::smp::CallQueue *smp_call{nullptr};
+};
+
+constexpr std::size_t kPreemptCountOffset = 8;
+static_assert(offsetof(CpuBlock, preempt_count) == kPreemptCountOffset);
+
+// Valid once install() ran on the calling CPU. Volatile so the load is redone
+// after anything that may have moved the thread to another CPU.
+inline CpuBlock *this_cpu() noexcept
+{
+    CpuBlock *b;
+    asm volatile("mov %%gs:0, %0" : "=r"(b));
+    return b;
+}
+
+// Returns the block of logical CPU `index`, allocating it on first use.
+// Index 0 (the BSP) uses a static block so it works before the heap.
+CpuBlock *create(std::size_t index, std::uint32_t apic_id) noexcept;
+CpuBlock *get(std::size_t index) noexcept;
+// Points the calling CPU's IA32_GS_BASE at `b`.
+void install(CpuBlock *b) noexcept;
+// Points GS at a shared scratch block, for an AP's first steps before its
+// own block is installed (locks already touch the preempt count there).
+void install_early() noexcept;
+
+} // namespace kern::percpu
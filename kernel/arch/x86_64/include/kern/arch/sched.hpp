@@ -1,11 +1,19 @@
 #pragma once
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
+#include "kern/arch/sched_policy.hpp"
 #include "kern/sched.hpp"
+#include "kern/sync/spinlock.hpp"
 
 namespace kern::sched
 {
 
+// Thread::block_state.
+constexpr std::uint8_t kRunnable = 0;
+constexpr std::uint8_t kBlocking = 1; // about to park, still on its CPU
+constexpr std::uint8_t kBlocked = 2;  // parked: off every queue, context saved
+
 struct Context
 {
     std::uint64_t rbx, rbp, r12, r13, r14, r15;
@@ -16,14 +24,116 @@ struct Context
 struct Thread
 {
     Context ctx{};
-    Thread *next{nullptr};
     Thread *all_next{nullptr};
     ThreadFn entry{nullptr};
+    std::uint32_t id{0}; // 0 for idle contexts
     bool finished{false};
     std::uint8_t *stack{nullptr};
     std::size_t stack_size{0};
+
+    // Normal-class queue links: treap children and priority under the fair
+    // policy, prev/next under round-robin.
+    Thread *rq_left{nullptr};
+    Thread *rq_right{nullptr};
+    std::uint32_t rq_prio{0};
+    bool on_rq{false};
+
+    // CPU whose run-queue lock guards this thread. Changes only with that
+    // lock held, so readers lock it and re-check.
+    std::atomic<std::size_t> cpu{0};
+    CpuMask affinity{CpuMask::all()};
+    std::size_t migrate_to{kNoCpu};
+
+    // Fair policy: weighted virtual runtime in TSC cycles.
+    std::uint64_t vruntime{0};
+    std::uint64_t exec_start{0};
+    std::uint32_t weight{kDefaultWeight};
+
+    // Deadline class (set_deadline()), in TSC cycles. dl_runtime == 0 means
+    // the thread belongs to the normal class.
+    std::uint64_t dl_runtime{0};
+    std::uint64_t dl_deadline{0};
+    std::uint64_t dl_period{0};
+    std::uint64_t dl_abs_deadline{0}; // current job's absolute deadline
+    std::uint64_t dl_next_period{0};  // next replenishment
+    std::uint64_t dl_budget{0};       // runtime left in this period
+    std::uint64_t dl_jobs{0};
+    std::uint64_t dl_misses{0};
+    Thread *dl_next{nullptr};
+    bool dl_overrun{false}; // budget ran out before the job finished
+
+    // Parking (park()/unpark()). A timed park links the thread into the
+    // sleepers list of sleep_cpu, under that CPU's run-queue lock.
+    std::atomic<std::uint8_t> block_state{kRunnable};
+    Thread *sleep_next{nullptr};
+    std::uint64_t sleep_deadline{0};
+    std::size_t sleep_cpu{kNoCpu};
+
+    // CPU-time accounting (thread_times()).
+    std::uint64_t run_time{0};
+    std::uint64_t wait_time{0};
+    std::uint64_t wait_start{0}; // TSC when it last became runnable
+    std::uint64_t nvcsw{0};
+    std::uint64_t nivcsw{0};
+    std::size_t last_cpu{kNoCpu};
+
+    // SIMD save area (kThreadSimd only) and the CPU it was last loaded on.
+    void *fpu_state{nullptr};
+    std::size_t fpu_cpu{kNoCpu};
+};
+
+struct RunQueue
+{
+    SchedPolicy::Queue policy{};  // normal-class threads
+    std::size_t nr_queued{0};     // threads in `policy` (excludes the running one)
+    std::uint64_t slice_start{0}; // TSC when the running thread was switched in
+
+    // Deadline class: runnable threads by absolute deadline, throttled ones
+    // (budget used up) by replenishment time.
+    Thread *dl_head{nullptr};
+    Thread *dl_throttled{nullptr};
+    std::size_t dl_nr{0};   // threads on dl_head
+    std::uint64_t dl_bw{0}; // admitted utilization, see kBwOne in sched.cpp
+};
+
+// Scheduler state of one CPU, embedded in its per-CPU block.
+struct CpuSched
+{
+    RunQueue rq{};
+    kern::sync::TicketLock rq_lock{"runq"}; // taken with interrupts off
+    Thread *current{nullptr};
+    // Thread switched away from, requeued by sched_finish_switch() once its
+    // context has been saved.
+    Thread *prev{nullptr};
+    // Threads parked with a timeout on this CPU, by sleep_deadline.
+    Thread *sleepers{nullptr};
+    // The CPU's boot context doubles as its idle thread.
+    Thread idle{};
+
+    // CPU-time accounting (cpu_times()); last_switch is the TSC of the
+    // latest switch, irq_enter that of the outermost interrupt in progress.
+    CpuTimes times{};
+    std::uint64_t last_switch{0};
+    std::uint64_t irq_enter{0};
+
+    // Idle wake-up, on a line of its own: a CPU that queues work here stores
+    // its TSC to wake_tsc, which also ends an MWAIT armed on this line.
+    // idle_state (owner-written) tells it whether an IPI is needed too.
+    alignas(64) std::atomic<std::uint64_t> wake_tsc{0};
+    std::atomic<std::uint32_t> idle_state{0};
+    IdleStats idle_stats{};
 };
 
 extern "C" void context_switch(Context *oldc, Context *newc) noexcept;
 
+// Blocking building blocks for wait primitives. The caller sets the current
+// thread's block_state to kBlocking, with interrupts off and under the lock
+// that guards its wait condition, drops that lock and calls park(). park()
+// switches away unless unpark() came first, and returns with interrupts on
+// once the thread is woken or, with a nonzero deadline (TSC), once that
+// passes. unpark() may be called from any CPU, including from interrupt
+// handlers; waking a thread that is not parking does nothing.
+void park(std::uint64_t deadline) noexcept;
+void unpark(Thread *t) noexcept;
+
 } // namespace kern::sched
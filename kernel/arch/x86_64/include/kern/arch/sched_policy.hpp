@@ -0,0 +1,94 @@
+#pragma once
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+
+namespace kern::sched
+{
+
+struct Thread;
+
+// Normal-class scheduling policies. The deadline class always runs first;
+// everything else is ordered by the policy picked at build time (xmake
+// option sched_policy), so the scheduler calls it directly, never through a
+// table. Each policy keeps its per-CPU state in a Queue embedded in the run
+// queue. All members are called with that run queue's lock held.
+template <typename P>
+concept Policy = requires(typename P::Queue &q, const typename P::Queue &cq, Thread *t, const Thread *ct,
+                          bool place, std::size_t n, std::uint32_t w, std::uint64_t v) {
+    // Prepares a new thread's policy fields.
+    { P::init_thread(t) } -> std::same_as<void>;
+    // Queues `t`; `place` is set for threads new to this queue.
+    { P::enqueue(q, t, place) } -> std::same_as<void>;
+    { P::dequeue(q, t) } -> std::same_as<void>;
+    // The thread to run next, left queued; nullptr if the queue is empty.
+    { P::pick_next(cq) } -> std::same_as<Thread *>;
+    // Charges `v` cycles of run time to the running thread.
+    { P::charge(q, t, v) } -> std::same_as<void>;
+    // Called when `t` is switched in.
+    { P::set_next(q, ct) } -> std::same_as<void>;
+    // True once the running thread, having run `v` cycles with `n` others
+    // queued, should give up the CPU.
+    { P::tick(cq, ct, n, v) } -> std::same_as<bool>;
+    // A queued thread a thief on CPU `n` may take, or nullptr.
+    { P::balance(cq, n) } -> std::same_as<Thread *>;
+    // Rebases a dequeued thread moving between two queues.
+    { P::move(t, cq, cq) } -> std::same_as<void>;
+    // Queued `t` is about to change to weight `w`.
+    { P::reweight(q, ct, w) } -> std::same_as<void>;
+};
+
+// Weighted fair queuing: a treap keyed on virtual runtime, slices split from
+// a latency period by weight.
+struct FairPolicy
+{
+    struct Queue
+    {
+        Thread *root{nullptr};  // treap of queued threads, ordered by vruntime
+        std::uint64_t load{0};  // sum of weights of queued threads
+        std::uint64_t min_vruntime{0};
+    };
+
+    static void init_thread(Thread *t) noexcept;
+    static void enqueue(Queue &q, Thread *t, bool place) noexcept;
+    static void dequeue(Queue &q, Thread *t) noexcept;
+    static Thread *pick_next(const Queue &q) noexcept;
+    static void charge(Queue &q, Thread *t, std::uint64_t delta) noexcept;
+    static void set_next(Queue &q, const Thread *t) noexcept;
+    static bool tick(const Queue &q, const Thread *t, std::size_t queued, std::uint64_t ran) noexcept;
+    static Thread *balance(const Queue &q, std::size_t cpu) noexcept;
+    static void move(Thread *t, const Queue &from, const Queue &to) noexcept;
+    static void reweight(Queue &q, const Thread *t, std::uint32_t weight) noexcept;
+};
+
+// Round-robin: one FIFO, a fixed slice each, weights ignored.
+struct RoundRobinPolicy
+{
+    struct Queue
+    {
+        Thread *head{nullptr};
+        Thread *tail{nullptr};
+    };
+
+    static void init_thread(Thread *t) noexcept;
+    static void enqueue(Queue &q, Thread *t, bool place) noexcept;
+    static void dequeue(Queue &q, Thread *t) noexcept;
+    static Thread *pick_next(const Queue &q) noexcept;
+    static void charge(Queue &q, Thread *t, std::uint64_t delta) noexcept;
+    static void set_next(Queue &q, const Thread *t) noexcept;
+    static bool tick(const Queue &q, const Thread *t, std::size_t queued, std::uint64_t ran) noexcept;
+    static Thread *balance(const Queue &q, std::size_t cpu) noexcept;
+    static void move(Thread *t, const Queue &from, const Queue &to) noexcept;
+    static void reweight(Queue &q, const Thread *t, std::uint32_t weight) noexcept;
+};
+
+#ifdef KERN_SCHED_RR
+using SchedPolicy = RoundRobinPolicy;
+#else
+using SchedPolicy = FairPolicy;
+#endif
+
+static_assert(Policy<FairPolicy>);
+static_assert(Policy<RoundRobinPolicy>);
+
+} // namespace kern::sched
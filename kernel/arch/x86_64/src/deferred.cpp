@@ -0,0 +1,210 @@
+#include "kern/deferred.hpp"
+#include "hal/console.hpp"
+#include "kern/arch/cpu.hpp"
+#include "kern/arch/percpu.hpp"
+#include "kern/interrupts.hpp"
+#include "kern/mem/heap.hpp"
+#include "kern/sched.hpp"
+#include "kern/time.hpp"
+#include <cstdint>
+#include <new>
+
+namespace kern::deferred
+{
+
+// Interrupt-exit budget: at most this many items or nanoseconds, whichever
+// runs out first. The rest waits for the deferred-work thread.
+constexpr std::uint32_t kIrqBatch = 16;
+constexpr std::uint64_t kIrqBudgetNs = 33'000;
+
+// Items the thread runs before giving other threads a turn.
+constexpr std::uint32_t kThreadBatch = 64;
+
+static_assert((kQueueSize & (kQueueSize - 1)) == 0);
+
+struct Item
+{
+    WorkFn fn;
+    void *arg;
+};
+
+// Touched only by the owning CPU, with interrupts off, so plain fields do.
+// head and tail count up forever; the slot is the index mod kQueueSize.
+// The thread sleeps on tail with wait_on().
+struct Queue
+{
+    std::uint32_t head{0}; // next item to run
+    std::uint32_t tail{0}; // next free slot
+    bool in_tail{false};   // irq_tail() is running on this CPU
+    kern::sched::Thread *thread{nullptr};
+    Stats stats{};
+    Item items[kQueueSize];
+};
+
+static inline Queue *this_queue() noexcept
+{
+    return kern::percpu::this_cpu()->deferred;
+}
+
+// Takes the oldest item. Interrupts must be off.
+static bool pop(Queue *q, Item &out) noexcept
+{
+    if (q->head == q->tail)
+        return false;
+    out = q->items[q->head % kQueueSize];
+    ++q->head;
+    return true;
+}
+
+bool queue(WorkFn fn, void *arg) noexcept
+{
+    if (!fn)
+        return false;
+    auto flags = kern::interrupts::save();
+    kern::interrupts::disable();
+    Queue *q = this_queue();
+    bool ok = q && q->tail - q->head < kQueueSize;
+    if (ok)
+    {
+        bool was_empty = q->head == q->tail;
+        q->items[q->tail % kQueueSize] = Item{fn, arg};
+        __atomic_store_n(&q->tail, q->tail + 1, __ATOMIC_RELEASE);
+        ++q->stats.queued;
+        if (was_empty)
+            kern::sched::wake(&q->tail, 1);
+    }
+    else if (q)
+    {
+        ++q->stats.dropped;
+    }
+    kern::interrupts::restore(flags);
+    return ok;
+}
+
+void irq_tail() noexcept
+{
+    Queue *q = this_queue();
+    // Nothing queued, or a nested interrupt while an outer one runs items.
+    if (!q || q->head == q->tail || q->in_tail)
+        return;
+    // The interrupted code is inside a SpinGuard or similar section; its
+    // locks are still held, so leave the items to the thread.
+    if (kern::percpu::this_cpu()->preempt_count != 0)
+        return;
+
+    // The interrupted thread must stay on this CPU while we run on its stack
+    // with interrupts on; a tick that wants it off waits for us.
+    q->in_tail = true;
+    kern::sched::preempt_disable();
+    std::uint64_t budget = kern::time::ns_to_cycles(kIrqBudgetNs);
+    std::uint64_t start = kern::arch::rdtsc();
+    std::uint32_t n = 0;
+    Item it;
+    while (n < kIrqBatch && kern::arch::rdtsc() - start < budget && pop(q, it))
+    {
+        ++n;
+        kern::interrupts::enable();
+        it.fn(it.arg);
+        kern::interrupts::disable();
+    }
+    q->stats.run_irq += n;
+    if (q->head != q->tail)
+        ++q->stats.over_budget;
+    // Interrupts are still off, so this cannot switch; a deferred
+    // preemption is taken by the caller or the next tick.
+    kern::sched::preempt_enable();
+    q->in_tail = false;
+}
+
+// Picks up what interrupt exits left over. Pinned to its CPU, so the queue
+// pointer stays valid. Sleeps on tail, which queue() wakes when it pushes
+// onto an empty queue.
+static void thread_main() noexcept
+{
+    Queue *q = this_queue();
+    for (;;)
+    {
+        std::uint32_t n = 0;
+        Item it;
+        kern::interrupts::disable();
+        while (n < kThreadBatch && pop(q, it))
+        {
+            ++n;
+            ++q->stats.run_thread;
+            kern::interrupts::enable();
+            it.fn(it.arg);
+            kern::interrupts::disable();
+        }
+        // Read with interrupts off: an item queued after this changes tail,
+        // so wait_on() does not sleep.
+        std::uint32_t seen = q->tail;
+        bool empty = q->head == seen;
+        kern::interrupts::enable();
+        if (!empty)
+        {
+            kern::sched::yield();
+            continue;
+        }
+        kern::sched::wait_on(&q->tail, seen);
+    }
+}
+
+void init_cpu() noexcept
+{
+    auto *b = kern::percpu::this_cpu();
+    if (b->deferred)
+        return;
+    void *mem = kern::mem::heap::kmalloc(sizeof(Queue), alignof(Queue));
+    if (!mem)
+        return;
+    auto *q = new (mem) Queue;
+    q->thread = kern::sched::create_on(b->index, thread_main);
+    if (!q->thread)
+    {
+        kern::mem::heap::kfree(mem);
+        return;
+    }
+    __atomic_store_n(&b->deferred, q, __ATOMIC_RELEASE);
+}
+
+Stats stats(std::size_t cpu) noexcept
+{
+    if (cpu >= kern::sched::cpu_count())
+        return {};
+    Queue *q = __atomic_load_n(&kern::percpu::get(cpu)->deferred, __ATOMIC_ACQUIRE);
+    if (!q)
+        return {};
+    Stats s{};
+    s.queued = __atomic_load_n(&q->stats.queued, __ATOMIC_RELAXED);
+    s.dropped = __atomic_load_n(&q->stats.dropped, __ATOMIC_RELAXED);
+    s.run_irq = __atomic_load_n(&q->stats.run_irq, __ATOMIC_RELAXED);
+    s.run_thread = __atomic_load_n(&q->stats.run_thread, __ATOMIC_RELAXED);
+    s.over_budget = __atomic_load_n(&q->stats.over_budget, __ATOMIC_RELAXED);
+    return s;
+}
+
+void dump_stats() noexcept
+{
+    std::size_t count = kern::sched::cpu_count();
+    for (std::size_t cpu = 0; cpu < count; ++cpu)
+    {
+        Stats s = stats(cpu);
+        if (!s.queued && !s.dropped)
+            continue;
+        hal::console::write("[deferred] cpu=");
+        hal::console::write_hex<std::uint32_t>(static_cast<std::uint32_t>(cpu));
+        hal::console::write(" queued=");
+        hal::console::write_hex<std::uint64_t>(s.queued);
+        hal::console::write(" irq=");
+        hal::console::write_hex<std::uint64_t>(s.run_irq);
+        hal::console::write(" thread=");
+        hal::console::write_hex<std::uint64_t>(s.run_thread);
+        hal::console::write(" over_budget=");
+        hal::console::write_hex<std::uint64_t>(s.over_budget);
+        hal::console::write(" dropped=");
+        hal::console::write_hex<std::uint64_t>(s.dropped);
+        hal::console::write("\n");
+    }
+}
+
+} // namespace kern::deferred
@@ -0,0 +1,227 @@
+#include "kern/fpu.hpp"
+#include "hal/console.hpp"
+#include "kern/arch/cpu.hpp"
+#include "kern/arch/interrupts.hpp"
+#include "kern/arch/percpu.hpp"
+#include "kern/mem/heap.hpp"
+
+namespace kern::fpu
+{
+
+constexpr std::uint8_t kNmVector = 7;
+
+constexpr std::uint64_t kCr0Mp = 1u << 1;
+constexpr std::uint64_t kCr0Em = 1u << 2;
+constexpr std::uint64_t kCr0Ts = 1u << 3;
+constexpr std::uint64_t kCr0Ne = 1u << 5;
+constexpr std::uint64_t kCr4OsFxsr = 1u << 9;
+constexpr std::uint64_t kCr4OsXmmExcpt = 1u << 10;
+constexpr std::uint64_t kCr4OsXsave = 1u << 18;
+
+constexpr std::uint64_t kXcrX87 = 1u << 0;
+constexpr std::uint64_t kXcrSse = 1u << 1;
+constexpr std::uint64_t kXcrAvx = 1u << 2;
+
+constexpr std::uint32_t kDefaultMxcsr = 0x1F80;
+constexpr std::uint16_t kDefaultFcw = 0x037F;
+
+static bool g_xsave = false;
+static bool g_xsaveopt = false;
+static bool g_avx = false;
+static std::uint64_t g_xcr0 = 0;
+static std::size_t g_state_size = 512; // FXSAVE layout until XSAVE says otherwise
+
+static inline std::uint64_t read_cr0() noexcept
+{
+    std::uint64_t v;
+    asm volatile("mov %%cr0, %0" : "=r"(v));
+    return v;
+}
+
+static inline void write_cr0(std::uint64_t v) noexcept
+{
+    asm volatile("mov %0, %%cr0" ::"r"(v) : "memory");
+}
+
+static inline std::uint64_t read_cr4() noexcept
+{
+    std::uint64_t v;
+    asm volatile("mov %%cr4, %0" : "=r"(v));
+    return v;
+}
+
+static inline void write_cr4(std::uint64_t v) noexcept
+{
+    asm volatile("mov %0, %%cr4" ::"r"(v) : "memory");
+}
+
+static inline void xsetbv(std::uint32_t reg, std::uint64_t v) noexcept
+{
+    asm volatile("xsetbv" ::"c"(reg), "a"(std::uint32_t(v)), "d"(std::uint32_t(v >> 32)));
+}
+
+static inline void set_ts(kern::percpu::CpuBlock *cpu) noexcept
+{
+    write_cr0(read_cr0() | kCr0Ts);
+    cpu->fpu_ts = true;
+}
+
+static inline void clear_ts(kern::percpu::CpuBlock *cpu) noexcept
+{
+    asm volatile("clts" ::: "memory");
+    cpu->fpu_ts = false;
+}
+
+static void save(void *area) noexcept
+{
+    std::uint32_t lo = std::uint32_t(g_xcr0);
+    std::uint32_t hi = std::uint32_t(g_xcr0 >> 32);
+    if (g_xsaveopt)
+        asm volatile("xsaveopt64 (%0)" ::"r"(area), "a"(lo), "d"(hi) : "memory");
+    else if (g_xsave)
+        asm volatile("xsave64 (%0)" ::"r"(area), "a"(lo), "d"(hi) : "memory");
+    else
+        asm volatile("fxsave64 (%0)" ::"r"(area) : "memory");
+}
+
+static void restore(const void *area) noexcept
+{
+    std::uint32_t lo = std::uint32_t(g_xcr0);
+    std::uint32_t hi = std::uint32_t(g_xcr0 >> 32);
+    if (g_xsave)
+        asm volatile("xrstor64 (%0)" ::"r"(area), "a"(lo), "d"(hi) : "memory");
+    else
+        asm volatile("fxrstor64 (%0)" ::"r"(area) : "memory");
+}
+
+// First SIMD instruction since CR0.TS was set: load the thread's state.
+static void nm_handler(kern::interrupts::Frame *frame) noexcept
+{
+    auto *cpu = kern::percpu::this_cpu();
+    auto *t = cpu->sched.current;
+    if (!t || !t->fpu_state)
+    {
+        hal::console::write("SIMD use outside a kThreadSimd thread or fpu::Region, rip=");
+        hal::console::write_hex<std::uint64_t>(frame->rip);
+        hal::console::write("\n");
+        for (;;)
+            asm volatile("hlt");
+    }
+
+    clear_ts(cpu);
+    if (cpu->fpu_owner != t || t->fpu_cpu != cpu->index)
+        restore(t->fpu_state);
+    cpu->fpu_owner = t;
+    t->fpu_cpu = cpu->index;
+}
+
+void init_cpu() noexcept
+{
+    auto l1 = kern::arch::cpuid(1);
+    g_xsave = (l1.ecx >> 26) & 1u;
+    g_avx = g_xsave && ((l1.ecx >> 28) & 1u);
+
+    write_cr0((read_cr0() & ~kCr0Em) | kCr0Mp | kCr0Ne);
+    std::uint64_t cr4 = read_cr4() | kCr4OsFxsr | kCr4OsXmmExcpt;
+    if (g_xsave)
+        cr4 |= kCr4OsXsave;
+    write_cr4(cr4);
+
+    if (g_xsave)
+    {
+        auto d0 = kern::arch::cpuid(0xD, 0);
+        std::uint64_t supported = (std::uint64_t(d0.edx) << 32) | d0.eax;
+        g_xcr0 = kXcrX87 | kXcrSse;
+        if (g_avx && (supported & kXcrAvx))
+            g_xcr0 |= kXcrAvx;
+        else
+            g_avx = false;
+        xsetbv(0, g_xcr0);
+
+        // EBX now reports the area size for the features just enabled.
+        g_state_size = kern::arch::cpuid(0xD, 0).ebx;
+        g_xsaveopt = kern::arch::cpuid(0xD, 1).eax & 1u;
+    }
+
+    asm volatile("fninit");
+    auto *cpu = kern::percpu::this_cpu();
+    cpu->fpu_owner = nullptr;
+    set_ts(cpu);
+
+    kern::interrupts::register_handler(kNmVector, nm_handler);
+}
+
+bool has_xsave() noexcept
+{
+    return g_xsave;
+}
+
+bool has_avx() noexcept
+{
+    return g_avx;
+}
+
+void *alloc_state() noexcept
+{
+    auto *area = static_cast<std::uint8_t *>(kern::mem::heap::kmalloc(g_state_size, 64));
+    if (!area)
+        return nullptr;
+    for (std::size_t i = 0; i < g_state_size; ++i)
+        area[i] = 0;
+
+    // Zero XSTATE_BV means "initial state" to XRSTOR; FXRSTOR needs sane
+    // control words. MXCSR is loaded from the area either way.
+    *reinterpret_cast<std::uint16_t *>(area + 0) = kDefaultFcw;
+    *reinterpret_cast<std::uint32_t *>(area + 24) = kDefaultMxcsr;
+    return area;
+}
+
+void free_state(void *state) noexcept
+{
+    kern::mem::heap::kfree(state);
+}
+
+// Lazy restore, eager save: whoever touched SIMD this slice is saved on the
+// way out, so the memory copy is always current and threads may move CPUs.
+// Threads without a save area pay at most one CR0 write after a SIMD thread.
+void switch_threads(kern::sched::Thread *prev, kern::sched::Thread *next) noexcept
+{
+    auto *cpu = kern::percpu::this_cpu();
+    if (!cpu->fpu_ts && cpu->fpu_owner == prev && prev->fpu_state)
+        save(prev->fpu_state);
+
+    if (next->fpu_state && cpu->fpu_owner == next && next->fpu_cpu == cpu->index)
+    {
+        if (cpu->fpu_ts)
+            clear_ts(cpu);
+    }
+    else if (!cpu->fpu_ts)
+    {
+        set_ts(cpu);
+    }
+}
+
+Region::Region() noexcept : flags_(kern::interrupts::save())
+{
+    kern::interrupts::disable();
+    auto *cpu = kern::percpu::this_cpu();
+
+    // With TS clear the owner (possibly the thread this interrupt stopped)
+    // has live registers its save area does not have yet. Otherwise its
+    // state was saved when it switched out. Either way #NM reloads it.
+    if (cpu->fpu_ts)
+        clear_ts(cpu);
+    else if (cpu->fpu_owner && cpu->fpu_owner->fpu_state)
+        save(cpu->fpu_owner->fpu_state);
+    cpu->fpu_owner = nullptr;
+    std::uint32_t mxcsr = kDefaultMxcsr;
+    asm volatile("fninit; ldmxcsr %0" ::"m"(mxcsr));
+}
+
+Region::~Region() noexcept
+{
+    set_ts(kern::percpu::this_cpu());
+    kern::interrupts::restore(flags_);
+}
+
+} // namespace kern::fpu
@@ -0,0 +1,142 @@
+#include "kern/arch/cpu.hpp"
+#include "kern/arch/sched.hpp"
+#include "kern/interrupts.hpp"
+#include "kern/sched.hpp"
+#include "kern/sync/spinlock.hpp"
+#include "kern/time.hpp"
+#include <atomic>
+#include <cstdint>
+
+namespace kern::sched
+{
+
+// Waiters hash by address into this many buckets.
+constexpr std::size_t kFutexBuckets = 256;
+
+// Lives on the waiting thread's stack for the duration of wait_on().
+struct FutexWaiter
+{
+    FutexWaiter *next{nullptr};
+    const std::uint32_t *addr{nullptr};
+    Thread *thread{nullptr};
+    bool queued{false}; // cleared by wake() when it takes the waiter
+};
+
+struct alignas(64) FutexBucket
+{
+    kern::sync::TicketLock lock{"futex"};
+    // Bumped before the value check, so wake() can skip empty buckets
+    // without taking the lock.
+    std::atomic<std::uint32_t> waiters{0};
+    FutexWaiter *head{nullptr};
+};
+
+static FutexBucket g_buckets[kFutexBuckets];
+
+static FutexBucket &bucket_of(const std::uint32_t *addr) noexcept
+{
+    auto a = reinterpret_cast<std::uintptr_t>(addr) >> 2;
+    return g_buckets[(a * 0x9E3779B97F4A7C15ull) >> 56];
+}
+static_assert(kFutexBuckets == 256);
+
+// Interrupts off for the whole hold: wake() runs from handlers too.
+static std::uint64_t bucket_lock(FutexBucket &b) noexcept
+{
+    auto flags = kern::interrupts::save();
+    kern::interrupts::disable();
+    b.lock.lock();
+    return flags;
+}
+
+static void bucket_unlock(FutexBucket &b, std::uint64_t flags) noexcept
+{
+    b.lock.unlock();
+    kern::interrupts::restore(flags);
+}
+
+static void unlink(FutexBucket &b, FutexWaiter *w) noexcept
+{
+    for (FutexWaiter **link = &b.head; *link; link = &(*link)->next)
+    {
+        if (*link == w)
+        {
+            *link = w->next;
+            return;
+        }
+    }
+}
+
+WaitResult wait_on(const std::uint32_t *addr, std::uint32_t expected, std::uint64_t timeout) noexcept
+{
+    std::uint64_t deadline = timeout ? kern::arch::rdtsc() + kern::time::ns_to_cycles(timeout) : 0;
+    FutexBucket &b = bucket_of(addr);
+    FutexWaiter w{};
+    w.addr = addr;
+    w.thread = current();
+
+    auto flags = bucket_lock(b);
+    b.waiters.fetch_add(1, std::memory_order_seq_cst);
+    // Pairs with the fence in wake(): either the waker sees us counted, or
+    // we see its new value here.
+    if (__atomic_load_n(addr, __ATOMIC_SEQ_CST) != expected)
+    {
+        b.waiters.fetch_sub(1, std::memory_order_relaxed);
+        bucket_unlock(b, flags);
+        return WaitResult::Mismatch;
+    }
+    w.next = b.head;
+    b.head = &w;
+    w.queued = true;
+    w.thread->block_state.store(kBlocking, std::memory_order_release);
+    b.lock.unlock(); // interrupts stay off into park()
+
+    park(deadline);
+
+    // A waiter still queued was not taken by wake(): the timeout fired (or
+    // the wake-up was spurious).
+    flags = bucket_lock(b);
+    bool queued = w.queued;
+    if (queued)
+    {
+        unlink(b, &w);
+        b.waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+    bucket_unlock(b, flags);
+    if (!queued)
+        return WaitResult::Woken;
+    return deadline && kern::arch::rdtsc() >= deadline ? WaitResult::TimedOut : WaitResult::Woken;
+}
+
+std::size_t wake(const std::uint32_t *addr, std::size_t n) noexcept
+{
+    if (n == 0)
+        return 0;
+    FutexBucket &b = bucket_of(addr);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (b.waiters.load(std::memory_order_seq_cst) == 0)
+        return 0;
+
+    // unpark() under the bucket lock: once a waiter is dequeued its thread
+    // may return and pop the node off its stack.
+    std::size_t woken = 0;
+    auto flags = bucket_lock(b);
+    for (FutexWaiter **link = &b.head; *link && woken < n;)
+    {
+        FutexWaiter *w = *link;
+        if (w->addr != addr)
+        {
+            link = &w->next;
+            continue;
+        }
+        *link = w->next;
+        w->queued = false;
+        b.waiters.fetch_sub(1, std::memory_order_relaxed);
+        unpark(w->thread);
+        ++woken;
+    }
+    bucket_unlock(b, flags);
+    return woken;
+}
+
+} // namespace kern::sched
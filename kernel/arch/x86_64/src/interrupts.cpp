@@ -1,7 +1,14 @@
 #include "kern/arch/interrupts.hpp"
 #include "hal/apic.hpp"
 #include "hal/console.hpp"
+#include "kern/arch/cpu.hpp"
+#include "kern/deferred.hpp"
+#include "kern/irq_stats.hpp"
+#include "kern/rcu.hpp"
 #include "kern/sched.hpp"
+#include "kern/smp.hpp"
+#include "kern/sync/spinlock.hpp"
+#include "kern/time.hpp"
 #include <atomic>
 
 namespace kern::interrupts
@@ -26,12 +33,15 @@ struct IdtPtr
 
 static IdtEntry g_idt[256] = {};
 static Handler g_handlers[256] = {};
-static std::atomic_flag g_idt_lock = ATOMIC_FLAG_INIT;
+static kern::sync::TicketLock g_idt_lock{"idt"};
 static std::atomic_bool g_idt_built = false;
 
 extern "C" void (*isr_stub_table[256])() noexcept;
+extern "C" void isr_fast_timer() noexcept;
+extern "C" void isr_fast_resched() noexcept;
+extern "C" void isr_fast_call() noexcept;
+extern "C" void isr_fast_probe() noexcept;
 
-static void timer_handler(Frame *frame) noexcept;
 static void spurious_handler(Frame *frame) noexcept;
 
 static inline void outb(std::uint16_t port, std::uint8_t v) noexcept
@@ -72,34 +82,80 @@ static void build_idt_once() noexcept
     if (g_idt_built.load(std::memory_order_acquire))
         return;
 
-    while (g_idt_lock.test_and_set(std::memory_order_acquire))
-        asm volatile("pause");
-
+    kern::sync::SpinGuard<kern::sync::TicketLock> guard(g_idt_lock);
     if (!g_idt_built.load(std::memory_order_relaxed))
     {
         disable_legacy_pic();
 
         for (std::size_t i = 0; i < 256; ++i)
             set_gate(static_cast<std::uint8_t>(i), isr_stub_table[i]);
+        // Hot vectors skip the handler table and the full register save.
+        set_gate(kTimerVector, isr_fast_timer);
+        set_gate(kReschedVector, isr_fast_resched);
+        set_gate(kCallVector, isr_fast_call);
+        set_gate(kProbeFastVector, isr_fast_probe);
 
-        register_handler(kTimerVector, timer_handler);
         register_handler(kSpuriousVector, spurious_handler);
 
         g_idt_built.store(true, std::memory_order_release);
     }
-
-    g_idt_lock.clear(std::memory_order_release);
 }
 
+// isr_dispatch() runs with interrupts off, an RCU read section, so a
+// handler unregistered here is no longer running anywhere on return.
 void register_handler(std::uint8_t vector, Handler handler) noexcept
 {
-    g_handlers[vector] = handler;
+    kern::rcu::assign(g_handlers[vector], handler);
+}
+
+void unregister_handler(std::uint8_t vector) noexcept
+{
+    kern::rcu::assign(g_handlers[vector], static_cast<Handler>(nullptr));
+    kern::rcu::synchronize();
+}
+
+// Deferred work runs only on exit from a device or IPI vector that
+// interrupted code with IF set. Exceptions, and `int` from code holding an
+// IrqSpinGuard, must not have interrupts turned on under them.
+static inline void deferred_tail(const Frame *frame) noexcept
+{
+    if (frame->vector >= 0x20 && (frame->rflags & 0x200))
+        kern::deferred::irq_tail();
 }
 
-static void timer_handler(Frame *frame) noexcept
+// Timer, reschedule (sent by a CPU that queued work here or wants our
+// thread moved) and cross-CPU call vectors, entered through the lean stubs with only
+// the caller-saved half of the frame. Returning true makes the stub save the
+// rest and call isr_preempt(), which does not come back here, so deferred
+// work runs first.
+extern "C" __attribute__((force_align_arg_pointer)) bool isr_fast_dispatch(Frame *frame) noexcept
 {
+    std::uint64_t start = kern::irqstat::start();
+    kern::sched::irq_enter();
     hal::apic::eoi();
-    kern::sched::yield_from_irq(frame);
+    if (frame->vector == kTimerVector)
+    {
+        kern::irqstat::timer_arrival(start);
+        kern::rcu::tick();
+    }
+    else if (frame->vector == kCallVector)
+    {
+        kern::smp::handle_call_ipi();
+    }
+    deferred_tail(frame);
+    bool preempt = kern::sched::irq_should_preempt();
+    kern::irqstat::record(static_cast<std::uint8_t>(frame->vector), start);
+    return preempt;
+}
+
+extern "C" __attribute__((force_align_arg_pointer)) void isr_preempt(Frame *frame) noexcept
+{
+    kern::sched::preempt_from_irq(frame);
+}
+
+extern "C" bool isr_probe_fast(Frame *) noexcept
+{
+    return false;
 }
 
 static void spurious_handler(Frame *frame) noexcept
@@ -112,11 +168,21 @@ extern "C" __attribute__((force_align_arg_pointer)) void isr_dispatch(Frame *fra
 {
     if (!frame)
         return;
+    // measure_entry_cost(): time the common stub alone, without the handler
+    // lookup, accounting and deferred-work hooks below.
+    if (frame->vector == kProbeVector)
+        return;
 
-    auto handler = g_handlers[static_cast<std::uint8_t>(frame->vector)];
+    std::uint64_t start = kern::irqstat::start();
+    auto vector = static_cast<std::uint8_t>(frame->vector);
+    auto handler = kern::rcu::dereference(g_handlers[vector]);
     if (handler)
     {
+        kern::sched::irq_enter();
         handler(frame);
+        deferred_tail(frame);
+        kern::irqstat::record(vector, start);
+        kern::sched::irq_exit();
         return;
     }
 
@@ -132,6 +198,7 @@ extern "C" __attribute__((force_align_arg_pointer)) void isr_dispatch(Frame *fra
             asm volatile("hlt");
     }
     hal::apic::eoi();
+    kern::irqstat::record(vector, start);
 }
 
 void init() noexcept
@@ -139,8 +206,29 @@ void init() noexcept
     build_idt_once();
     load_idt();
 
-    // Configure LAPIC timer for periodic interrupts.
-    hal::apic::timer_init(kTimerVector, 1000000, 0x3, true); // divide=16, count≈tunable
+    // Configure LAPIC timer for periodic interrupts. Uncalibrated, fall back
+    // to a fixed count.
+    std::uint32_t count = kern::time::timer_count(kTickNs);
+    hal::apic::timer_init(kTimerVector, count ? count : 1000000, kTimerDivide, true);
+}
+
+EntryCost measure_entry_cost() noexcept
+{
+    constexpr std::uint64_t kRounds = 1000;
+    build_idt_once();
+    auto flags = save();
+    disable();
+    EntryCost cost{};
+    std::uint64_t start = kern::arch::rdtsc();
+    for (std::uint64_t i = 0; i < kRounds; ++i)
+        asm volatile("int %0" ::"i"(kProbeVector) : "memory");
+    cost.full = (kern::arch::rdtsc() - start) / kRounds;
+    start = kern::arch::rdtsc();
+    for (std::uint64_t i = 0; i < kRounds; ++i)
+        asm volatile("int %0" ::"i"(kProbeFastVector) : "memory");
+    cost.lean = (kern::arch::rdtsc() - start) / kRounds;
+    restore(flags);
+    return cost;
 }
 
 void enable() noexcept
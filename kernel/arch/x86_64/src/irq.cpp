@@ -0,0 +1,289 @@
+#include "kern/irq.hpp"
+#include "hal/apic.hpp"
+#include "hal/console.hpp"
+#include "hal/ioapic.hpp"
+#include "kern/arch/interrupts.hpp"
+#include "kern/arch/percpu.hpp"
+#include "kern/sync/spinlock.hpp"
+#include "kern/topology.hpp"
+#include <cstdint>
+
+namespace kern::irq
+{
+
+using kern::interrupts::Frame;
+using kern::interrupts::Handler;
+using kern::sched::kNoCpu;
+
+// Inputs taking fewer interrupts per pass than this are left where they are.
+constexpr std::uint64_t kBalanceMinRate = 16;
+
+// One routed input, indexed by vector.
+struct Route
+{
+    Handler handler;
+    std::uint32_t gsi;
+    std::size_t cpu;
+    std::uint64_t count; // bumped by the CPU that takes the interrupt
+    std::uint64_t last_count;
+    std::uint64_t rate; // interrupts during the last balancing pass
+    bool used;
+    bool pinned;
+    bool placed; // balance() only
+};
+
+static Route g_routes[256] = {};
+static std::uint64_t g_vector_used[4] = {};
+static kern::sync::TicketLock g_lock{"irq"};
+static kern::sched::Thread *g_balancer = nullptr;
+using Guard = kern::sync::SpinGuard<kern::sync::TicketLock>;
+
+static inline std::uint32_t apic_of(std::size_t cpu) noexcept
+{
+    return kern::percpu::get(cpu)->apic_id;
+}
+
+// The same handler serves every routed vector: count, then dispatch.
+static void device_entry(Frame *frame) noexcept
+{
+    Route &r = g_routes[static_cast<std::uint8_t>(frame->vector)];
+    __atomic_fetch_add(&r.count, 1, __ATOMIC_RELAXED);
+    r.handler(frame);
+}
+
+static std::uint8_t alloc_vector_locked() noexcept
+{
+    for (unsigned v = kern::interrupts::kFirstDeviceVector; v <= kern::interrupts::kLastDeviceVector; ++v)
+    {
+        std::uint64_t bit = std::uint64_t(1) << (v % 64);
+        if (!(g_vector_used[v / 64] & bit))
+        {
+            g_vector_used[v / 64] |= bit;
+            return static_cast<std::uint8_t>(v);
+        }
+    }
+    return 0;
+}
+
+static void free_vector_locked(std::uint8_t v) noexcept
+{
+    g_vector_used[v / 64] &= ~(std::uint64_t(1) << (v % 64));
+}
+
+std::uint8_t alloc_vector() noexcept
+{
+    Guard guard(g_lock);
+    return alloc_vector_locked();
+}
+
+void free_vector(std::uint8_t vector) noexcept
+{
+    if (vector < kern::interrupts::kFirstDeviceVector || vector > kern::interrupts::kLastDeviceVector)
+        return;
+    Guard guard(g_lock);
+    free_vector_locked(vector);
+}
+
+// The CPU with the fewest routed inputs, preferring first CPUs of cores.
+static std::size_t quietest_cpu_locked() noexcept
+{
+    std::size_t count = kern::sched::cpu_count();
+    std::size_t best = 0, best_score = ~std::size_t(0);
+    for (std::size_t cpu = 0; cpu < count; ++cpu)
+    {
+        std::size_t score = 0;
+        for (const Route &r : g_routes)
+        {
+            if (r.used && kern::topology::same_core(r.cpu, cpu))
+                score += 2;
+        }
+        if (kern::topology::get(cpu).smt)
+            ++score;
+        if (score < best_score)
+        {
+            best = cpu;
+            best_score = score;
+        }
+    }
+    return best;
+}
+
+std::uint8_t request_gsi(std::uint32_t gsi, bool level, bool active_low, Handler handler, std::size_t cpu) noexcept
+{
+    if (!handler || !hal::ioapic::present() || gsi >= hal::ioapic::gsi_count())
+        return 0;
+    if (cpu != kNoCpu && cpu >= kern::sched::cpu_count())
+        return 0;
+
+    std::uint8_t vector;
+    {
+        Guard guard(g_lock);
+        for (const Route &r : g_routes)
+        {
+            if (r.used && r.gsi == gsi)
+                return 0;
+        }
+        vector = alloc_vector_locked();
+        if (!vector)
+            return 0;
+        Route &r = g_routes[vector];
+        r = Route{};
+        r.handler = handler;
+        r.gsi = gsi;
+        r.pinned = cpu != kNoCpu;
+        r.cpu = r.pinned ? cpu : quietest_cpu_locked();
+        r.used = true;
+        cpu = r.cpu;
+    }
+
+    kern::interrupts::register_handler(vector, device_entry);
+    if (!hal::ioapic::route(gsi, vector, apic_of(cpu), level, active_low))
+    {
+        release(vector);
+        return 0;
+    }
+    hal::ioapic::unmask(gsi);
+    return vector;
+}
+
+std::uint8_t request_isa(std::uint8_t irq, Handler handler, std::size_t cpu) noexcept
+{
+    auto route = hal::ioapic::isa_route(irq);
+    return request_gsi(route.gsi, route.level, route.active_low, handler, cpu);
+}
+
+void release(std::uint8_t vector) noexcept
+{
+    std::uint32_t gsi;
+    {
+        Guard guard(g_lock);
+        if (!g_routes[vector].used)
+            return;
+        gsi = g_routes[vector].gsi;
+    }
+    hal::ioapic::mask(gsi);
+    kern::interrupts::unregister_handler(vector);
+    Guard guard(g_lock);
+    g_routes[vector].used = false;
+    free_vector_locked(vector);
+}
+
+bool set_affinity(std::uint8_t vector, std::size_t cpu) noexcept
+{
+    if (cpu >= kern::sched::cpu_count())
+        return false;
+    Guard guard(g_lock);
+    Route &r = g_routes[vector];
+    if (!r.used)
+        return false;
+    r.pinned = true;
+    if (r.cpu == cpu)
+        return true;
+    if (!hal::ioapic::set_destination(r.gsi, apic_of(cpu)))
+        return false;
+    r.cpu = cpu;
+    return true;
+}
+
+// Greedy: the busiest inputs pick first, each taking the core with the
+// least interrupt load so far. An input stays put unless moving gains more
+// than a quarter of its own rate, so steady loads do not ping-pong.
+void balance() noexcept
+{
+    std::size_t count = kern::sched::cpu_count();
+    std::uint64_t load[kern::sched::kMaxCpus]; // per core, indexed by its first CPU
+    std::size_t first[kern::sched::kMaxCpus];
+    for (std::size_t cpu = 0; cpu < count; ++cpu)
+    {
+        load[cpu] = 0;
+        first[cpu] = cpu;
+        for (std::size_t j = 0; j < cpu; ++j)
+        {
+            if (kern::topology::same_core(j, cpu))
+            {
+                first[cpu] = first[j];
+                break;
+            }
+        }
+    }
+
+    Guard guard(g_lock);
+    for (Route &r : g_routes)
+    {
+        r.placed = false;
+        if (!r.used)
+            continue;
+        std::uint64_t c = __atomic_load_n(&r.count, __ATOMIC_RELAXED);
+        r.rate = c - r.last_count;
+        r.last_count = c;
+        // Pinned and quiet inputs still count towards their core's load.
+        if (r.pinned || r.rate < kBalanceMinRate)
+            load[first[r.cpu]] += r.rate;
+    }
+
+    for (;;)
+    {
+        Route *busiest = nullptr;
+        for (Route &r : g_routes)
+        {
+            if (r.used && !r.pinned && !r.placed && r.rate >= kBalanceMinRate && (!busiest || r.rate > busiest->rate))
+                busiest = &r;
+        }
+        if (!busiest)
+            break;
+        busiest->placed = true;
+
+        std::size_t best = first[busiest->cpu];
+        std::size_t here = best;
+        for (std::size_t cpu = 0; cpu < count; ++cpu)
+        {
+            if (first[cpu] == cpu && load[cpu] < load[best])
+                best = cpu;
+        }
+        if (best != here && load[here] > load[best] + busiest->rate / 4 &&
+            hal::ioapic::set_destination(busiest->gsi, apic_of(best)))
+            busiest->cpu = best;
+        load[first[busiest->cpu]] += busiest->rate;
+    }
+}
+
+static void balancer_main() noexcept
+{
+    static const std::uint32_t never = 0;
+    for (;;)
+    {
+        kern::sched::wait_on(&never, 0, kBalanceInterval);
+        balance();
+    }
+}
+
+void start_balancer() noexcept
+{
+    Guard guard(g_lock);
+    if (!g_balancer && hal::ioapic::present())
+        g_balancer = kern::sched::create(balancer_main);
+}
+
+void dump() noexcept
+{
+    Guard guard(g_lock);
+    for (std::size_t v = 0; v < 256; ++v)
+    {
+        const Route &r = g_routes[v];
+        if (!r.used)
+            continue;
+        hal::console::write("[irq] vec=");
+        hal::console::write_hex<std::uint32_t>(static_cast<std::uint32_t>(v));
+        hal::console::write(" gsi=");
+        hal::console::write_hex<std::uint32_t>(r.gsi);
+        hal::console::write(" cpu=");
+        hal::console::write_hex<std::uint32_t>(static_cast<std::uint32_t>(r.cpu));
+        hal::console::write(" count=");
+        hal::console::write_hex<std::uint64_t>(__atomic_load_n(&r.count, __ATOMIC_RELAXED));
+        hal::console::write(" rate=");
+        hal::console::write_hex<std::uint64_t>(r.rate);
+        hal::console::write(r.pinned ? " pinned\n" : "\n");
+    }
+}
+
+} // namespace kern::irq
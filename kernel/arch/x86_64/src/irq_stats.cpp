@@ -0,0 +1,200 @@
+#include "kern/irq_stats.hpp"
+#include "hal/console.hpp"
+#include "kern/arch/cpu.hpp"
+#include "kern/arch/interrupts.hpp"
+#include "kern/arch/percpu.hpp"
+#include "kern/mem/heap.hpp"
+#include "kern/sched.hpp"
+#include "kern/time.hpp"
+#include <cstdint>
+#include <new>
+
+namespace kern::irqstat
+{
+
+// Written only by the owning CPU, from interrupt context; readers on other
+// CPUs load each field on its own and may see a count a tick ahead of its
+// histogram.
+struct CpuStats
+{
+    VectorStats vectors[256];
+    TimerJitter timer;
+    std::uint64_t last_tick;
+};
+
+#ifdef KERN_IRQ_STATS
+
+static inline std::size_t bucket(std::uint64_t cycles) noexcept
+{
+    unsigned log = 63 - static_cast<unsigned>(__builtin_clzll(cycles | 1));
+    if (log < kHistShift)
+        return 0;
+    log -= kHistShift;
+    return log < kHistBuckets ? log : kHistBuckets - 1;
+}
+
+void init_cpu() noexcept
+{
+    auto *b = kern::percpu::this_cpu();
+    if (b->irq_stats)
+        return;
+    void *mem = kern::mem::heap::kmalloc(sizeof(CpuStats), alignof(CpuStats));
+    if (!mem)
+        return;
+    auto *s = static_cast<CpuStats *>(mem);
+    auto *bytes = static_cast<std::uint8_t *>(mem);
+    for (std::size_t i = 0; i < sizeof(CpuStats); ++i)
+        bytes[i] = 0;
+    __atomic_store_n(&b->irq_stats, s, __ATOMIC_RELEASE);
+}
+
+void record(std::uint8_t vector, std::uint64_t start) noexcept
+{
+    CpuStats *s = kern::percpu::this_cpu()->irq_stats;
+    if (!s)
+        return;
+    std::uint64_t cycles = kern::arch::rdtsc() - start;
+    VectorStats &v = s->vectors[vector];
+    ++v.count;
+    v.total_cycles += cycles;
+    if (cycles > v.max_cycles)
+        v.max_cycles = cycles;
+    ++v.hist[bucket(cycles)];
+}
+
+void timer_arrival(std::uint64_t now) noexcept
+{
+    CpuStats *s = kern::percpu::this_cpu()->irq_stats;
+    if (!s)
+        return;
+    TimerJitter &t = s->timer;
+    std::uint64_t last = s->last_tick;
+    s->last_tick = now;
+    ++t.ticks;
+    if (!last)
+        return;
+    std::uint64_t interval = now - last;
+    bool calibrated = kern::time::timer_count(kern::interrupts::kTickNs) != 0;
+    if (calibrated)
+        t.period = kern::time::ns_to_cycles(kern::interrupts::kTickNs);
+    else if (!t.period)
+    {
+        t.period = interval;
+        return;
+    }
+    std::uint64_t jitter = interval > t.period ? interval - t.period : t.period - interval;
+    if (jitter > t.max)
+        t.max = jitter;
+    ++t.hist[bucket(jitter)];
+    // Uncalibrated: average over roughly the last 16 ticks.
+    if (!calibrated)
+        t.period = t.period - t.period / 16 + interval / 16;
+}
+
+#else
+
+void init_cpu() noexcept
+{
+}
+
+#endif
+
+static CpuStats *stats_of(std::size_t cpu) noexcept
+{
+    if (cpu >= kern::sched::cpu_count())
+        return nullptr;
+    return __atomic_load_n(&kern::percpu::get(cpu)->irq_stats, __ATOMIC_ACQUIRE);
+}
+
+static void load_hist(std::uint32_t (&out)[kHistBuckets], const std::uint32_t (&in)[kHistBuckets]) noexcept
+{
+    for (std::size_t i = 0; i < kHistBuckets; ++i)
+        out[i] = __atomic_load_n(&in[i], __ATOMIC_RELAXED);
+}
+
+VectorStats vector_stats(std::size_t cpu, std::uint8_t vector) noexcept
+{
+    CpuStats *s = stats_of(cpu);
+    if (!s)
+        return {};
+    const VectorStats &v = s->vectors[vector];
+    VectorStats out{};
+    out.count = __atomic_load_n(&v.count, __ATOMIC_RELAXED);
+    out.total_cycles = __atomic_load_n(&v.total_cycles, __ATOMIC_RELAXED);
+    out.max_cycles = __atomic_load_n(&v.max_cycles, __ATOMIC_RELAXED);
+    load_hist(out.hist, v.hist);
+    return out;
+}
+
+TimerJitter timer_jitter(std::size_t cpu) noexcept
+{
+    CpuStats *s = stats_of(cpu);
+    if (!s)
+        return {};
+    const TimerJitter &t = s->timer;
+    TimerJitter out{};
+    out.ticks = __atomic_load_n(&t.ticks, __ATOMIC_RELAXED);
+    out.period = __atomic_load_n(&t.period, __ATOMIC_RELAXED);
+    out.max = __atomic_load_n(&t.max, __ATOMIC_RELAXED);
+    load_hist(out.hist, t.hist);
+    return out;
+}
+
+// Buckets as a comma-separated list, trailing empty ones dropped.
+static void write_hist(const std::uint32_t (&hist)[kHistBuckets]) noexcept
+{
+    std::size_t n = kHistBuckets;
+    while (n > 1 && !hist[n - 1])
+        --n;
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        if (i)
+            hal::console::write(",");
+        hal::console::write_hex<std::uint32_t>(hist[i]);
+    }
+}
+
+void dump() noexcept
+{
+    std::size_t count = kern::sched::cpu_count();
+    for (std::size_t cpu = 0; cpu < count; ++cpu)
+    {
+        if (!stats_of(cpu))
+            continue;
+        for (std::size_t vec = 0; vec < 256; ++vec)
+        {
+            VectorStats v = vector_stats(cpu, static_cast<std::uint8_t>(vec));
+            if (!v.count)
+                continue;
+            hal::console::write("[irq] cpu=");
+            hal::console::write_hex<std::uint32_t>(static_cast<std::uint32_t>(cpu));
+            hal::console::write(" vec=");
+            hal::console::write_hex<std::uint32_t>(static_cast<std::uint32_t>(vec));
+            hal::console::write(" count=");
+            hal::console::write_hex<std::uint64_t>(v.count);
+            hal::console::write(" avg=");
+            hal::console::write_hex<std::uint64_t>(v.total_cycles / v.count);
+            hal::console::write(" max=");
+            hal::console::write_hex<std::uint64_t>(v.max_cycles);
+            hal::console::write(" hist=");
+            write_hist(v.hist);
+            hal::console::write("\n");
+        }
+        TimerJitter t = timer_jitter(cpu);
+        if (!t.ticks)
+            continue;
+        hal::console::write("[irq] cpu=");
+        hal::console::write_hex<std::uint32_t>(static_cast<std::uint32_t>(cpu));
+        hal::console::write(" ticks=");
+        hal::console::write_hex<std::uint64_t>(t.ticks);
+        hal::console::write(" period=");
+        hal::console::write_hex<std::uint64_t>(t.period);
+        hal::console::write(" jitter_max=");
+        hal::console::write_hex<std::uint64_t>(t.max);
+        hal::console::write(" jitter_hist=");
+        write_hist(t.hist);
+        hal::console::write("\n");
+    }
+}
+
+} // namespace kern::irqstat
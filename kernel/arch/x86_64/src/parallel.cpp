@@ -0,0 +1,293 @@
+#include "kern/parallel.hpp"
+#include "kern/mem/heap.hpp"
+#include "kern/sched.hpp"
+#include "kern/sync/spinlock.hpp"
+#include <atomic>
+#include <cstdint>
+#include <new>
+
+namespace kern::parallel
+{
+
+// Pending ranges per participant. Splitting halves a range each time, so a
+// deque holds at most ~log2(range / grain) entries; when it is full the
+// range simply runs unsplit.
+constexpr std::int64_t kDequeSize = 64;
+
+struct Job;
+
+struct Range
+{
+    std::size_t begin;
+    std::size_t end;
+};
+
+// Chase-Lev work-stealing deque: the owner pushes and pops at the bottom,
+// thieves take from the top. Fixed size, so no buffer swapping.
+struct Deque
+{
+    std::atomic<std::int64_t> top{0};
+    std::atomic<std::int64_t> bottom{0};
+    Range items[kDequeSize];
+};
+
+struct Job
+{
+    RangeFn fn;
+    void *ctx;
+    std::size_t grain;
+    std::uint64_t gen;
+    std::size_t workers; // workers with a lower slot take part
+    std::atomic<std::size_t> remaining; // indices not finished yet
+};
+
+struct Worker
+{
+    kern::sched::Thread *thread{nullptr};
+};
+
+static Deque *g_deques = nullptr;   // one per slot; the caller uses the last
+static Worker *g_workers = nullptr; // one per CPU, pinned there
+static std::size_t g_nworkers = 0;
+static std::atomic_bool g_ready = false;
+static kern::sync::TicketLock g_init_lock{"parallel_init"};
+static bool g_init_failed = false;
+
+// One job at a time. Workers announce themselves in g_active before reading
+// g_job, so the caller knows when nobody can still touch its Job.
+static std::atomic<Job *> g_job = nullptr;
+static std::atomic_uint g_active = 0;
+static kern::sync::TicketLock g_job_lock{"parallel_job"}; // guards the g_job_owner handoff
+static std::atomic<kern::sched::Thread *> g_job_owner = nullptr;
+static std::uint64_t g_next_gen = 1;
+static std::atomic<std::size_t> g_max_workers = ~std::size_t(0); // set_concurrency() cap
+
+// Bumped whenever a job is published or retired. Idle workers and callers
+// waiting for the pool sleep on it with wait_on().
+static std::uint32_t g_job_seq = 0;
+
+static void bump_job_seq() noexcept
+{
+    __atomic_fetch_add(&g_job_seq, 1, __ATOMIC_SEQ_CST);
+    kern::sched::wake(&g_job_seq, kern::sched::kWakeAll);
+}
+
+static bool push(Deque &d, const Range &r) noexcept
+{
+    std::int64_t b = d.bottom.load(std::memory_order_relaxed);
+    std::int64_t t = d.top.load(std::memory_order_acquire);
+    if (b - t >= kDequeSize)
+        return false;
+    d.items[b % kDequeSize] = r;
+    std::atomic_thread_fence(std::memory_order_release);
+    d.bottom.store(b + 1, std::memory_order_relaxed);
+    return true;
+}
+
+static bool pop(Deque &d, Range &out) noexcept
+{
+    std::int64_t b = d.bottom.load(std::memory_order_relaxed) - 1;
+    d.bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    std::int64_t t = d.top.load(std::memory_order_relaxed);
+    if (t > b)
+    {
+        d.bottom.store(b + 1, std::memory_order_relaxed);
+        return false;
+    }
+    out = d.items[b % kDequeSize];
+    if (t == b)
+    {
+        // Last item: race the thieves for it.
+        bool won = d.top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+        d.bottom.store(b + 1, std::memory_order_relaxed);
+        return won;
+    }
+    return true;
+}
+
+static bool steal(Deque &d, Range &out) noexcept
+{
+    std::int64_t t = d.top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    std::int64_t b = d.bottom.load(std::memory_order_acquire);
+    if (t >= b)
+        return false;
+    out = d.items[t % kDequeSize];
+    return d.top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+}
+
+// Splits off upper halves for thieves until the range is one grain, then
+// runs it and counts it towards the join.
+static void execute(std::size_t slot, Job *j, Range r) noexcept
+{
+    while (r.end - r.begin > j->grain)
+    {
+        std::size_t mid = r.begin + (r.end - r.begin) / 2;
+        if (!push(g_deques[slot], Range{mid, r.end}))
+            break;
+        r.end = mid;
+    }
+    j->fn(r.begin, r.end, slot, j->ctx);
+    j->remaining.fetch_sub(r.end - r.begin, std::memory_order_acq_rel);
+}
+
+static void participate(std::size_t slot, Job *j) noexcept
+{
+    std::size_t nslots = g_nworkers + 1;
+    while (j->remaining.load(std::memory_order_acquire) != 0)
+    {
+        Range r;
+        if (pop(g_deques[slot], r))
+        {
+            execute(slot, j, r);
+            continue;
+        }
+        bool found = false;
+        for (std::size_t i = 1; i < nslots && !found; ++i)
+            found = steal(g_deques[(slot + i) % nslots], r);
+        if (found)
+            execute(slot, j, r);
+        else
+            asm volatile("pause");
+    }
+}
+
+static void worker_main() noexcept
+{
+    std::size_t slot = kern::sched::current_cpu();
+    std::uint64_t last_gen = 0;
+    for (;;)
+    {
+        // Snapshot before the look at g_job: a job published after it
+        // changes the word, so wait_on() returns at once.
+        std::uint32_t seen = __atomic_load_n(&g_job_seq, __ATOMIC_SEQ_CST);
+        g_active.fetch_add(1, std::memory_order_seq_cst);
+        Job *j = g_job.load(std::memory_order_seq_cst);
+        bool fresh = j && j->gen != last_gen;
+        if (fresh)
+        {
+            last_gen = j->gen;
+            if (slot < j->workers)
+                participate(slot, j);
+        }
+        g_active.fetch_sub(1, std::memory_order_release);
+        if (fresh)
+            continue;
+
+        kern::sched::wait_on(&g_job_seq, seen);
+    }
+}
+
+static bool ensure_pool() noexcept
+{
+    if (g_ready.load(std::memory_order_acquire))
+        return true;
+
+    kern::sync::SpinGuard<kern::sync::TicketLock> guard(g_init_lock);
+    if (!g_ready.load(std::memory_order_relaxed) && !g_init_failed)
+    {
+        std::size_t n = kern::sched::cpu_count();
+        void *dq = kern::mem::heap::kmalloc(sizeof(Deque) * (n + 1), alignof(Deque));
+        void *wk = kern::mem::heap::kmalloc(sizeof(Worker) * n, alignof(Worker));
+        if (dq && wk)
+        {
+            g_deques = static_cast<Deque *>(dq);
+            g_workers = static_cast<Worker *>(wk);
+            for (std::size_t i = 0; i <= n; ++i)
+                new (&g_deques[i]) Deque;
+            for (std::size_t i = 0; i < n; ++i)
+                new (&g_workers[i]) Worker{};
+            g_nworkers = n;
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                g_workers[i].thread = kern::sched::create_on(i, worker_main);
+                if (!g_workers[i].thread)
+                    g_init_failed = true;
+            }
+        }
+        else
+        {
+            kern::mem::heap::kfree(dq);
+            kern::mem::heap::kfree(wk);
+            g_init_failed = true;
+        }
+        // Workers that did start stay parked; without a full pool run()
+        // falls back to serial execution.
+        if (!g_init_failed)
+            g_ready.store(true, std::memory_order_release);
+    }
+    return g_ready.load(std::memory_order_acquire);
+}
+
+static bool is_worker(kern::sched::Thread *t) noexcept
+{
+    for (std::size_t i = 0; i < g_nworkers; ++i)
+    {
+        if (g_workers[i].thread == t)
+            return true;
+    }
+    return false;
+}
+
+std::size_t slots() noexcept
+{
+    return ensure_pool() ? g_nworkers + 1 : 1;
+}
+
+void set_concurrency(std::size_t n) noexcept
+{
+    g_max_workers.store(n ? n - 1 : ~std::size_t(0), std::memory_order_relaxed);
+}
+
+void run(std::size_t begin, std::size_t end, std::size_t grain, RangeFn fn, void *ctx) noexcept
+{
+    if (begin >= end)
+        return;
+    if (grain == 0)
+        grain = 1;
+
+    kern::sched::Thread *self = kern::sched::current();
+    if (!ensure_pool() || end - begin <= grain || is_worker(self) ||
+        g_job_owner.load(std::memory_order_relaxed) == self)
+    {
+        fn(begin, end, 0, ctx);
+        return;
+    }
+
+    // Callers queue for the pool by sleeping until the owner retires.
+    for (;;)
+    {
+        std::uint32_t seen = __atomic_load_n(&g_job_seq, __ATOMIC_SEQ_CST);
+        {
+            kern::sync::SpinGuard<kern::sync::TicketLock> guard(g_job_lock);
+            if (!g_job_owner.load(std::memory_order_relaxed))
+            {
+                g_job_owner.store(self, std::memory_order_relaxed);
+                break;
+            }
+        }
+        kern::sched::wait_on(&g_job_seq, seen);
+    }
+
+    Job job{fn, ctx, grain, g_next_gen++, g_max_workers.load(std::memory_order_relaxed), {end - begin}};
+    std::size_t slot = g_nworkers;
+    push(g_deques[slot], Range{begin, end});
+    g_job.store(&job, std::memory_order_seq_cst);
+    bump_job_seq();
+
+    // Join by helping: the caller drains chunks until all are done.
+    participate(slot, &job);
+
+    g_job.store(nullptr, std::memory_order_seq_cst);
+    while (g_active.load(std::memory_order_acquire) != 0)
+        asm volatile("pause");
+
+    {
+        kern::sync::SpinGuard<kern::sync::TicketLock> guard(g_job_lock);
+        g_job_owner.store(nullptr, std::memory_order_relaxed);
+    }
+    bump_job_seq();
+}
+
+} // namespace kern::parallel
@@ -0,0 +1,56 @@
+#include "kern/arch/percpu.hpp"
+#include "kern/arch/cpu.hpp"
+#include "kern/mem/heap.hpp"
+#include <new>
+
+namespace kern::percpu
+{
+
+static CpuBlock g_boot_block = {&g_boot_block};
+static CpuBlock *g_blocks[kern::sched::kMaxCpus] = {};
+static CpuBlock g_early_block = {&g_early_block};
+
+CpuBlock *create(std::size_t index, std::uint32_t apic_id) noexcept
+{
+    if (index >= kern::sched::kMaxCpus)
+        return nullptr;
+    if (index == 0)
+    {
+        g_boot_block.apic_id = apic_id;
+        return &g_boot_block;
+    }
+    if (CpuBlock *b = get(index))
+        return b;
+
+    void *mem = kern::mem::heap::kmalloc(sizeof(CpuBlock), alignof(CpuBlock));
+    if (!mem)
+        return nullptr;
+    auto *b = new (mem) CpuBlock{};
+    b->self = b;
+    b->index = index;
+    b->apic_id = apic_id;
+    b->sched.idle.cpu.store(index, std::memory_order_relaxed);
+    __atomic_store_n(&g_blocks[index], b, __ATOMIC_RELEASE);
+    return b;
+}
+
+CpuBlock *get(std::size_t index) noexcept
+{
+    if (index == 0)
+        return &g_boot_block;
+    if (index >= kern::sched::kMaxCpus)
+        return nullptr;
+    return __atomic_load_n(&g_blocks[index], __ATOMIC_ACQUIRE);
+}
+
+void install(CpuBlock *b) noexcept
+{
+    kern::arch::wrmsr(kern::arch::kMsrGsBase, reinterpret_cast<std::uint64_t>(b));
+}
+
+void install_early() noexcept
+{
+    install(&g_early_block);
+}
+
+} // namespace kern::percpu
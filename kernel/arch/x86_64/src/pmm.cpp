@@ -1,5 +1,6 @@
 #include "kern/mem/pmm.hpp"
 #include "kern/arch/mb2.hpp"
+#include "kern/sync/spinlock.hpp"
 #include <atomic>
 
 extern "C" char _kernel_end;
@@ -11,19 +12,11 @@ static std::uint8_t *g_bitmap = nullptr;
 static std::size_t g_bitmap_bytes = 0;
 static std::size_t g_frames_total = 0;
 static std::size_t g_frames_free = 0;
-static std::atomic_flag g_lock = ATOMIC_FLAG_INIT;
+static kern::sync::TicketLock g_lock{"pmm"};
 static std::atomic_bool g_ready = false;
 
-static inline void lock() noexcept
-{
-    while (g_lock.test_and_set(std::memory_order_acquire))
-        asm volatile("pause");
-}
-
-static inline void unlock() noexcept
-{
-    g_lock.clear(std::memory_order_release);
-}
+// Taken with preemption off, never from interrupt handlers.
+using Guard = kern::sync::SpinGuard<kern::sync::TicketLock>;
 
 static inline std::size_t addr_to_frame(std::uintptr_t addr)
 {
@@ -147,19 +140,16 @@ std::uintptr_t alloc_frame() noexcept
 {
     if (!g_ready.load(std::memory_order_acquire) || !g_bitmap)
         return 0;
-    lock();
+    Guard guard(g_lock);
     for (std::size_t f = 0; f < g_frames_total; ++f)
     {
         if (!bit_get(f))
         {
             bit_set(f);
             --g_frames_free;
-            auto phys = static_cast<std::uintptr_t>(f) * kPageSize;
-            unlock();
-            return phys;
+            return static_cast<std::uintptr_t>(f) * kPageSize;
         }
     }
-    unlock();
     return 0;
 }
 
@@ -167,34 +157,26 @@ void free_frame(std::uintptr_t phys) noexcept
 {
     if (!g_ready.load(std::memory_order_acquire) || !g_bitmap)
         return;
-    lock();
+    Guard guard(g_lock);
     auto f = addr_to_frame(phys);
     if (f >= g_frames_total)
-    {
-        unlock();
         return;
-    }
     if (bit_get(f))
     {
         bit_clr(f);
         ++g_frames_free;
     }
-    unlock();
 }
 
 std::size_t total_frames() noexcept
 {
-    lock();
-    auto v = g_frames_total;
-    unlock();
-    return v;
+    Guard guard(g_lock);
+    return g_frames_total;
 }
 std::size_t free_frames() noexcept
 {
-    lock();
-    auto v = g_frames_free;
-    unlock();
-    return v;
+    Guard guard(g_lock);
+    return g_frames_free;
 }
 
 } // namespace kern::mem::pmm
@@ -0,0 +1,222 @@
+#include "kern/rcu.hpp"
+#include "hal/console.hpp"
+#include "kern/arch/percpu.hpp"
+#include "kern/deferred.hpp"
+#include "kern/interrupts.hpp"
+#include "kern/mem/heap.hpp"
+#include "kern/sync/spinlock.hpp"
+#include <atomic>
+#include <cstdint>
+#include <new>
+
+namespace kern::rcu
+{
+
+// Callbacks a deferred-work item runs before requeueing itself.
+constexpr std::uint32_t kBatch = 32;
+
+// Grace periods are numbered. g_gp_seq is the latest one started, g_gp_done
+// the latest one completed (equal when none is in progress), g_gp_wanted
+// the latest one a caller waits for.
+static std::atomic<std::uint64_t> g_gp_seq = 0;
+static std::atomic<std::uint64_t> g_gp_done = 0;
+static std::atomic<std::uint64_t> g_gp_wanted = 0;
+static kern::sync::TicketLock g_gp_lock{"rcu"};
+
+struct alignas(64) CpuState
+{
+    // Grace period this CPU has last been quiescent in; read by advance().
+    std::uint64_t seen{0};
+    // Callbacks in call() order, so their seq never decreases. Touched only
+    // by the owning CPU with interrupts off.
+    Head *head{nullptr};
+    Head *tail{nullptr};
+    bool run_queued{false};
+    Stats stats{};
+};
+
+static inline CpuState *this_state() noexcept
+{
+    return kern::percpu::this_cpu()->rcu;
+}
+
+static void want(std::uint64_t seq) noexcept
+{
+    std::uint64_t w = g_gp_wanted.load(std::memory_order_relaxed);
+    while (w < seq && !g_gp_wanted.compare_exchange_weak(w, seq, std::memory_order_relaxed))
+    {
+    }
+}
+
+// Completes the current grace period once every CPU has seen it, and starts
+// the next if someone waits. Whoever finds the lock taken leaves it to the
+// holder or the next tick.
+static void advance() noexcept
+{
+    std::uint64_t seq = g_gp_seq.load(std::memory_order_acquire);
+    if (seq == g_gp_done.load(std::memory_order_relaxed) && g_gp_wanted.load(std::memory_order_relaxed) <= seq)
+        return;
+    if (!g_gp_lock.try_lock())
+        return;
+
+    seq = g_gp_seq.load(std::memory_order_relaxed);
+    bool done = seq == g_gp_done.load(std::memory_order_relaxed);
+    if (!done)
+    {
+        done = true;
+        std::size_t count = kern::sched::cpu_count();
+        for (std::size_t cpu = 0; cpu < count && done; ++cpu)
+        {
+            // A CPU without state has not run a reader yet.
+            CpuState *st = __atomic_load_n(&kern::percpu::get(cpu)->rcu, __ATOMIC_ACQUIRE);
+            done = !st || __atomic_load_n(&st->seen, __ATOMIC_ACQUIRE) >= seq;
+        }
+        if (done)
+            g_gp_done.store(seq, std::memory_order_release);
+    }
+    if (done && g_gp_wanted.load(std::memory_order_relaxed) > seq)
+        g_gp_seq.store(seq + 1, std::memory_order_seq_cst);
+    g_gp_lock.unlock();
+}
+
+void quiescent() noexcept
+{
+    auto *b = kern::percpu::this_cpu();
+    CpuState *st = b->rcu;
+    if (!st || b->preempt_count)
+        return;
+    std::uint64_t seq = g_gp_seq.load(std::memory_order_acquire);
+    if (st->seen != seq)
+        __atomic_store_n(&st->seen, seq, __ATOMIC_RELEASE);
+}
+
+static void run_callbacks(void *arg) noexcept
+{
+    auto *st = static_cast<CpuState *>(arg);
+    std::uint32_t n = 0;
+    kern::interrupts::disable();
+    std::uint64_t done = g_gp_done.load(std::memory_order_acquire);
+    while (n < kBatch && st->head && st->head->seq <= done)
+    {
+        Head *h = st->head;
+        st->head = h->next;
+        if (!st->head)
+            st->tail = nullptr;
+        ++n;
+        kern::interrupts::enable();
+        h->fn(h);
+        kern::interrupts::disable();
+    }
+    st->stats.run += n;
+    // More ready ones: go round the deferred queue again.
+    st->run_queued = st->head && st->head->seq <= done && kern::deferred::queue(run_callbacks, st);
+    kern::interrupts::enable();
+}
+
+void tick() noexcept
+{
+    CpuState *st = this_state();
+    if (!st)
+        return;
+    quiescent();
+    advance();
+    if (st->head && !st->run_queued && st->head->seq <= g_gp_done.load(std::memory_order_acquire))
+        st->run_queued = kern::deferred::queue(run_callbacks, st);
+}
+
+void call(Head *head, Callback fn) noexcept
+{
+    if (!head || !fn)
+        return;
+    auto flags = kern::interrupts::save();
+    kern::interrupts::disable();
+    CpuState *st = this_state();
+    if (!st)
+    {
+        // Before init_cpu() there are no readers to wait for.
+        kern::interrupts::restore(flags);
+        fn(head);
+        return;
+    }
+    head->next = nullptr;
+    head->fn = fn;
+    // The unlink must be visible before we read which grace period is
+    // current: any period that starts after this load covers it.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    head->seq = g_gp_seq.load(std::memory_order_relaxed) + 1;
+    if (st->tail)
+        st->tail->next = head;
+    else
+        st->head = head;
+    st->tail = head;
+    ++st->stats.queued;
+    want(head->seq);
+    advance();
+    kern::interrupts::restore(flags);
+}
+
+void synchronize() noexcept
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    std::uint64_t seq = g_gp_seq.load(std::memory_order_relaxed) + 1;
+    want(seq);
+    while (g_gp_done.load(std::memory_order_acquire) < seq)
+    {
+        auto flags = kern::interrupts::save();
+        kern::interrupts::disable();
+        advance();
+        kern::interrupts::restore(flags);
+        kern::sched::yield();
+    }
+}
+
+void init_cpu() noexcept
+{
+    auto *b = kern::percpu::this_cpu();
+    if (b->rcu)
+        return;
+    void *mem = kern::mem::heap::kmalloc(sizeof(CpuState), alignof(CpuState));
+    if (!mem)
+        return;
+    auto *st = new (mem) CpuState{};
+    // Nothing on this CPU reads RCU data yet, so it is quiescent already.
+    st->seen = g_gp_seq.load(std::memory_order_acquire);
+    __atomic_store_n(&b->rcu, st, __ATOMIC_RELEASE);
+}
+
+Stats stats(std::size_t cpu) noexcept
+{
+    if (cpu >= kern::sched::cpu_count())
+        return {};
+    CpuState *st = __atomic_load_n(&kern::percpu::get(cpu)->rcu, __ATOMIC_ACQUIRE);
+    if (!st)
+        return {};
+    Stats s{};
+    s.grace_periods = g_gp_done.load(std::memory_order_relaxed);
+    s.queued = __atomic_load_n(&st->stats.queued, __ATOMIC_RELAXED);
+    s.run = __atomic_load_n(&st->stats.run, __ATOMIC_RELAXED);
+    return s;
+}
+
+void dump_stats() noexcept
+{
+    hal::console::write("[rcu] grace_periods=");
+    hal::console::write_hex<std::uint64_t>(g_gp_done.load(std::memory_order_relaxed));
+    hal::console::write("\n");
+    std::size_t count = kern::sched::cpu_count();
+    for (std::size_t cpu = 0; cpu < count; ++cpu)
+    {
+        Stats s = stats(cpu);
+        if (!s.queued)
+            continue;
+        hal::console::write("[rcu] cpu=");
+        hal::console::write_hex<std::uint32_t>(static_cast<std::uint32_t>(cpu));
+        hal::console::write(" queued=");
+        hal::console::write_hex<std::uint64_t>(s.queued);
+        hal::console::write(" run=");
+        hal::console::write_hex<std::uint64_t>(s.run);
+        hal::console::write("\n");
+    }
+}
+
+} // namespace kern::rcu
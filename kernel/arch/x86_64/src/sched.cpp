@@ -1,148 +1,656 @@
 #include "kern/arch/sched.hpp"
 #include "hal/apic.hpp"
-#include "kern/interrupts.hpp"
+#include "hal/console.hpp"
+#include "kern/arch/cpu.hpp"
+#include "kern/arch/interrupts.hpp"
+#include "kern/arch/percpu.hpp"
+#include "kern/deferred.hpp"
+#include "kern/fpu.hpp"
+#include "kern/irq_stats.hpp"
 #include "kern/mem/heap.hpp"
+#include "kern/rcu.hpp"
+#include "kern/smp.hpp"
+#include "kern/sync/rwlock.hpp"
+#include "kern/time.hpp"
+#include "kern/topology.hpp"
+#include "kern/trace.hpp"
 #include <atomic>
 #include <cstdint>
+#include <new>
 
 namespace kern::sched
 {
 
-constexpr std::size_t kMaxCpus = 256;
+// Deadline class admission: utilization in units of kBwOne per CPU. The
+// headroom keeps the normal class from being starved outright.
+constexpr std::uint64_t kBwOne = 1u << 20;
+constexpr std::uint64_t kBwLimit = kBwOne * 95 / 100;
 
-static Thread *g_runq[kMaxCpus] = {};
-static std::atomic_flag g_runq_lock[kMaxCpus];
+// Idle CPUs spin this long (nanoseconds) before MWAIT/HLT, so work that
+// arrives right away is picked up without a wake-up.
+constexpr std::uint64_t kIdlePollNs = 7'000;
 
-static Thread *g_current[kMaxCpus] = {};
-static Thread g_bootstrap[kMaxCpus] = {};
+// CpuSched::idle_state.
+constexpr std::uint32_t kIdleRunning = 0;
+constexpr std::uint32_t kIdlePolling = 1;
+constexpr std::uint32_t kIdleMwaiting = 2;
+constexpr std::uint32_t kIdleHalted = 3;
+
+// Per-CPU scheduler state lives in each CPU's percpu::CpuBlock and is
+// indexed by logical CPU index, not APIC ID.
+static inline CpuSched &cs(std::size_t cpu) noexcept
+{
+    return kern::percpu::get(cpu)->sched;
+}
 
 static Thread *g_all_threads = nullptr;
-static std::atomic_flag g_all_lock = ATOMIC_FLAG_INIT;
+static kern::sync::TicketLock g_all_lock{"threads"};
 
-static std::uint32_t g_cpu_list[kMaxCpus] = {};
-static std::atomic_flag g_cpu_lock = ATOMIC_FLAG_INIT;
+// APIC ID -> logical CPU. x2APIC IDs are 32-bit and sparse, so this is an
+// open-addressed table twice the CPU limit rather than an array indexed by
+// ID. Entries are only ever added; zero-filled means empty.
+struct ApicSlot
+{
+    std::uint32_t apic_id;
+    std::uint16_t cpu_plus1; // logical CPU + 1, 0 = empty
+};
+constexpr std::size_t kApicSlots = kMaxCpus * 2;
+static ApicSlot g_apic_to_cpu[kApicSlots] = {};
+// Read on every register_cpu()/cpu_for_apic(), written once per CPU.
+static kern::sync::RwLock g_cpu_lock{"cpus"};
 static std::atomic_uint g_cpu_count = 0;
 static std::atomic_uint g_rr_counter = 0;
+static std::atomic_uint g_next_id = 1;
 static std::atomic_bool g_apic_ready = false;
+static std::atomic_bool g_mwait_supported = false;
+static std::atomic_bool g_mwait = false;
+
+// The slot holding `apic_id`, or the empty one where it would go. Caller
+// holds g_cpu_lock; the table is never more than half full.
+static ApicSlot &apic_slot(std::uint32_t apic_id) noexcept
+{
+    std::size_t i = (apic_id * 0x9E3779B1u) % kApicSlots;
+    while (g_apic_to_cpu[i].cpu_plus1 && g_apic_to_cpu[i].apic_id != apic_id)
+        i = (i + 1) % kApicSlots;
+    return g_apic_to_cpu[i];
+}
 
 extern "C" void thread_entry_trampoline() noexcept;
 extern "C" void irq_return_trampoline() noexcept;
+extern "C" void sched_finish_switch() noexcept;
 
 static inline void runq_lock(std::size_t cpu) noexcept
 {
-    while (g_runq_lock[cpu].test_and_set(std::memory_order_acquire))
-        asm volatile("pause");
+    cs(cpu).rq_lock.lock();
 }
 
 static inline void runq_unlock(std::size_t cpu) noexcept
 {
-    g_runq_lock[cpu].clear(std::memory_order_release);
+    cs(cpu).rq_lock.unlock();
 }
 
-static inline void all_lock() noexcept
+// Two run-queue locks are always taken in index order.
+static void runq_lock_pair(std::size_t a, std::size_t b) noexcept
 {
-    while (g_all_lock.test_and_set(std::memory_order_acquire))
-        asm volatile("pause");
+    if (a == b)
+    {
+        runq_lock(a);
+        return;
+    }
+    runq_lock(a < b ? a : b);
+    runq_lock(a < b ? b : a);
 }
 
-static inline void all_unlock() noexcept
+static void runq_unlock_pair(std::size_t a, std::size_t b) noexcept
 {
-    g_all_lock.clear(std::memory_order_release);
+    runq_unlock(a);
+    if (a != b)
+        runq_unlock(b);
 }
 
-static inline void cpu_list_lock() noexcept
+// Locks the run queue that currently owns `t` and returns its index.
+static std::size_t lock_thread_rq(Thread *t) noexcept
 {
-    while (g_cpu_lock.test_and_set(std::memory_order_acquire))
-        asm volatile("pause");
+    for (;;)
+    {
+        std::size_t cpu = t->cpu.load(std::memory_order_relaxed);
+        runq_lock(cpu);
+        if (t->cpu.load(std::memory_order_relaxed) == cpu)
+            return cpu;
+        runq_unlock(cpu);
+    }
 }
 
-static inline void cpu_list_unlock() noexcept
+// The thread and CPU lists are only touched from threads.
+using ListGuard = kern::sync::SpinGuard<kern::sync::TicketLock>;
+using CpuListGuard = kern::sync::SpinGuard<kern::sync::RwLock>;
+
+static inline std::size_t cpu_index() noexcept
 {
-    g_cpu_lock.clear(std::memory_order_release);
+    return kern::percpu::this_cpu()->index;
 }
 
-static inline std::size_t cpu_index() noexcept
+static inline bool is_idle(const Thread *t) noexcept
 {
-    if (!g_apic_ready.load(std::memory_order_acquire))
-        return 0;
-    auto id = static_cast<std::size_t>(hal::apic::lapic_id());
-    if (id >= kMaxCpus)
-        return 0;
-    return id;
+    return !t->entry;
 }
 
-static Thread *pop_runq_locked(std::size_t cpu) noexcept
+static inline bool is_dl(const Thread *t) noexcept
 {
-    Thread *head = g_runq[cpu];
-    if (!head)
-        return nullptr;
-    g_runq[cpu] = head->next;
-    head->next = nullptr;
-    return head;
+    return t->dl_runtime != 0;
 }
 
-static void push_runq_locked(std::size_t cpu, Thread *t) noexcept
+static inline std::uint64_t dl_bw(const Thread *t) noexcept
 {
-    t->next = nullptr;
-    if (!g_runq[cpu])
+    std::uint64_t bw = t->dl_runtime * kBwOne / t->dl_period;
+    return bw ? bw : 1;
+}
+
+static inline std::size_t online_count() noexcept
+{
+    std::size_t count = g_cpu_count.load(std::memory_order_acquire);
+    return count == 0 ? 1 : count;
+}
+
+// Runnable threads on `cpu`, counting the running one. Racy by design: only
+// used for placement heuristics.
+static std::size_t cpu_load(std::size_t cpu) noexcept
+{
+    std::size_t load = __atomic_load_n(&cs(cpu).rq.nr_queued, __ATOMIC_RELAXED);
+    load += __atomic_load_n(&cs(cpu).rq.dl_nr, __ATOMIC_RELAXED);
+    Thread *cur = __atomic_load_n(&cs(cpu).current, __ATOMIC_RELAXED);
+    if (cur && !is_idle(cur))
+        ++load;
+    return load;
+}
+
+// True if no SMT sibling of `cpu` (itself included) has work.
+static bool core_idle(std::size_t cpu) noexcept
+{
+    std::size_t count = online_count();
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        if (kern::topology::same_core(cpu, i) && cpu_load(i) != 0)
+            return false;
+    }
+    return true;
+}
+
+// Charges the running thread for the time since it was last accounted:
+// policy run time for normal threads, budget for deadline threads.
+static void update_curr(RunQueue &rq, Thread *cur, std::uint64_t now) noexcept
+{
+    std::uint64_t delta = now > cur->exec_start ? now - cur->exec_start : 0;
+    cur->exec_start = now;
+    if (!is_dl(cur))
+        SchedPolicy::charge(rq.policy, cur, delta);
+    else if (delta < cur->dl_budget)
+        cur->dl_budget -= delta;
+    else if (cur->dl_budget)
+    {
+        cur->dl_budget = 0;
+        cur->dl_overrun = true;
+    }
+}
+
+// Deadline queues are short sorted lists through dl_next.
+static void dl_list_insert(Thread *&head, Thread *t, std::uint64_t Thread::*key) noexcept
+{
+    Thread **link = &head;
+    while (*link && (*link)->*key <= t->*key)
+        link = &(*link)->dl_next;
+    t->dl_next = *link;
+    *link = t;
+}
+
+static bool dl_list_remove(Thread *&head, Thread *t) noexcept
+{
+    for (Thread **link = &head; *link; link = &(*link)->dl_next)
     {
-        g_runq[cpu] = t;
+        if (*link == t)
+        {
+            *link = t->dl_next;
+            t->dl_next = nullptr;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Starts the first period of a thread entering the deadline class.
+static void dl_start(Thread *t, std::uint64_t now) noexcept
+{
+    t->dl_budget = t->dl_runtime;
+    t->dl_abs_deadline = now + t->dl_deadline;
+    t->dl_next_period = now + t->dl_period;
+    t->dl_overrun = false;
+}
+
+// Refills the budget for the next period. A thread more than a period behind
+// restarts from `now` rather than bursting to catch up.
+static void dl_replenish(Thread *t, std::uint64_t now) noexcept
+{
+    if (t->dl_overrun)
+    {
+        ++t->dl_misses;
+        t->dl_overrun = false;
+    }
+    std::uint64_t start = t->dl_next_period;
+    if (start + t->dl_period <= now)
+        start = now;
+    t->dl_budget = t->dl_runtime;
+    t->dl_abs_deadline = start + t->dl_deadline;
+    t->dl_next_period = start + t->dl_period;
+}
+
+static void dl_enqueue_locked(std::size_t cpu, Thread *t, std::uint64_t now) noexcept
+{
+    RunQueue &rq = cs(cpu).rq;
+    t->cpu.store(cpu, std::memory_order_relaxed);
+    t->on_rq = true;
+    if (t->dl_budget == 0 && now >= t->dl_next_period)
+        dl_replenish(t, now);
+    if (t->dl_budget == 0)
+    {
+        dl_list_insert(rq.dl_throttled, t, &Thread::dl_next_period);
         return;
     }
-    Thread *p = g_runq[cpu];
-    while (p->next)
-        p = p->next;
-    p->next = t;
+    dl_list_insert(rq.dl_head, t, &Thread::dl_abs_deadline);
+    ++rq.dl_nr;
 }
 
-static Thread *pop_runq(std::size_t cpu) noexcept
+static void dl_dequeue_locked(std::size_t cpu, Thread *t) noexcept
 {
-    runq_lock(cpu);
-    Thread *t = pop_runq_locked(cpu);
-    runq_unlock(cpu);
+    RunQueue &rq = cs(cpu).rq;
+    if (dl_list_remove(rq.dl_head, t))
+        --rq.dl_nr;
+    else
+        dl_list_remove(rq.dl_throttled, t);
+    t->on_rq = false;
+}
+
+// Moves throttled threads whose next period has started back to dl_head.
+static void dl_wake_due(RunQueue &rq, std::uint64_t now) noexcept
+{
+    while (rq.dl_throttled && rq.dl_throttled->dl_next_period <= now)
+    {
+        Thread *t = rq.dl_throttled;
+        rq.dl_throttled = t->dl_next;
+        dl_replenish(t, now);
+        dl_list_insert(rq.dl_head, t, &Thread::dl_abs_deadline);
+        ++rq.dl_nr;
+    }
+}
+
+// `place` is set for threads arriving from elsewhere (new or moved), so
+// the policy can place them on its timeline rather than trust stale state.
+static void enqueue_locked(std::size_t cpu, Thread *t, bool place) noexcept
+{
+    if (is_dl(t))
+    {
+        dl_enqueue_locked(cpu, t, kern::arch::rdtsc());
+        return;
+    }
+    RunQueue &rq = cs(cpu).rq;
+    t->cpu.store(cpu, std::memory_order_relaxed);
+    t->on_rq = true;
+    SchedPolicy::enqueue(rq.policy, t, place);
+    ++rq.nr_queued;
+}
+
+static void dequeue_locked(std::size_t cpu, Thread *t) noexcept
+{
+    if (is_dl(t))
+    {
+        dl_dequeue_locked(cpu, t);
+        return;
+    }
+    RunQueue &rq = cs(cpu).rq;
+    SchedPolicy::dequeue(rq.policy, t);
+    --rq.nr_queued;
+    t->on_rq = false;
+}
+
+// Wakes threads whose park() timeout on `cpu` has passed. They parked on
+// this CPU, so they are queued here.
+static void wake_sleepers_locked(std::size_t cpu, std::uint64_t now) noexcept
+{
+    CpuSched &c = cs(cpu);
+    while (c.sleepers && c.sleepers->sleep_deadline <= now)
+    {
+        Thread *t = c.sleepers;
+        c.sleepers = t->sleep_next;
+        t->sleep_next = nullptr;
+        t->sleep_cpu = kNoCpu;
+
+        std::uint8_t s = kBlocking;
+        if (t->block_state.compare_exchange_strong(s, kRunnable, std::memory_order_acq_rel))
+            continue; // still switching out; sched_finish_switch() requeues it
+        if (s == kBlocked && t->block_state.compare_exchange_strong(s, kRunnable, std::memory_order_acq_rel))
+        {
+            t->wait_start = now;
+            enqueue_locked(cpu, t, true);
+        }
+    }
+}
+
+// The deadline class always goes first.
+static Thread *pick_next_locked(std::size_t cpu) noexcept
+{
+    RunQueue &rq = cs(cpu).rq;
+    std::uint64_t now = kern::arch::rdtsc();
+    wake_sleepers_locked(cpu, now);
+    dl_wake_due(rq, now);
+    if (Thread *t = rq.dl_head)
+    {
+        dl_dequeue_locked(cpu, t);
+        return t;
+    }
+    Thread *t = SchedPolicy::pick_next(rq.policy);
+    if (t)
+        dequeue_locked(cpu, t);
     return t;
 }
 
-static void push_runq(std::size_t cpu, Thread *t) noexcept
+// Rebases a dequeued thread from one CPU's queue onto another's.
+static void renormalize(Thread *t, std::size_t from, std::size_t to) noexcept
+{
+    SchedPolicy::move(t, cs(from).rq.policy, cs(to).rq.policy);
+}
+
+// Marks `next` as running on `cpu`. Both must stay under the run-queue lock
+// so migrate() sees a consistent running/queued state.
+static void set_next_locked(std::size_t cpu, Thread *prev, Thread *next, std::uint64_t now) noexcept
+{
+    // Accounting: a handful of adds on values already in cache.
+    CpuSched &c = cs(cpu);
+    std::uint64_t ran = c.last_switch && now > c.last_switch ? now - c.last_switch : 0;
+    c.last_switch = now;
+    if (is_idle(prev))
+        c.times.idle += ran;
+    else
+    {
+        c.times.busy += ran;
+        prev->run_time += ran;
+        prev->wait_start = now; // requeued right after the switch
+    }
+    if (!is_idle(next))
+    {
+        if (next->wait_start && now > next->wait_start)
+            next->wait_time += now - next->wait_start;
+        next->wait_start = 0;
+        next->last_cpu = cpu;
+    }
+
+    next->exec_start = now;
+    next->cpu.store(cpu, std::memory_order_relaxed);
+    cs(cpu).rq.slice_start = now;
+    if (!is_idle(next) && !is_dl(next))
+        SchedPolicy::set_next(cs(cpu).rq.policy, next);
+    cs(cpu).prev = prev;
+    __atomic_store_n(&cs(cpu).current, next, __ATOMIC_RELAXED);
+    kern::percpu::this_cpu()->need_resched = 0;
+}
+
+// True if `t` may keep running on `cpu` without a pending move.
+static inline bool stays_on(const Thread *t, std::size_t cpu) noexcept
+{
+    return t->migrate_to == kNoCpu && t->affinity.test(cpu);
+}
+
+// True if `t` has to give up `cpu` even when nothing else is runnable.
+static inline bool must_leave(const Thread *t, std::size_t cpu) noexcept
+{
+    return !stays_on(t, cpu) || (is_dl(t) && t->dl_budget == 0);
+}
+
+static std::size_t first_allowed(const CpuMask &mask, std::size_t start) noexcept
+{
+    std::size_t count = online_count();
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        std::size_t cpu = (start + i) % count;
+        if (mask.test(cpu))
+            return cpu;
+    }
+    return kNoCpu;
+}
+
+// Where a thread leaving `cpu` should be queued next.
+static std::size_t requeue_target(const Thread *t, std::size_t cpu) noexcept
+{
+    if (t->migrate_to != kNoCpu)
+        return t->migrate_to;
+    if (t->affinity.test(cpu))
+        return cpu;
+    std::size_t dst = first_allowed(t->affinity, cpu);
+    return dst == kNoCpu ? cpu : dst;
+}
+
+// Wakes `cpu` if it is waiting in idle_wait(). Polling and MWAIT-idle CPUs
+// only need the store to wake_tsc; halted ones get a reschedule IPI.
+static void kick_if_idle(std::size_t cpu) noexcept
+{
+    if (cpu == cpu_index())
+        return;
+    CpuSched &c = cs(cpu);
+    // Pairs with the fence in idle_wait(): either we see the CPU idle, or it
+    // sees the work we just queued.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    std::uint32_t state = c.idle_state.load(std::memory_order_relaxed);
+    if (state == kIdleRunning)
+        return;
+    c.wake_tsc.store(kern::arch::rdtsc(), std::memory_order_release);
+    if (state == kIdleHalted && g_apic_ready.load(std::memory_order_acquire))
+        hal::apic::send_ipi(kern::percpu::get(cpu)->apic_id, kern::interrupts::kReschedVector);
+}
+
+static void enqueue(std::size_t cpu, Thread *t, bool place) noexcept
 {
+    auto flags = kern::interrupts::save();
+    kern::interrupts::disable();
     runq_lock(cpu);
-    push_runq_locked(cpu, t);
+    enqueue_locked(cpu, t, place);
     runq_unlock(cpu);
+    kern::interrupts::restore(flags);
+    kick_if_idle(cpu);
+}
+
+// Pulls one queued thread from another CPU. Called from the idle loop with
+// interrupts off and no run-queue lock held.
+static bool steal_into(std::size_t cpu) noexcept
+{
+    // First pass stays within our last-level cache, second goes anywhere.
+    std::size_t count = online_count();
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        for (std::size_t i = 1; i < count; ++i)
+        {
+            std::size_t victim = (cpu + i) % count;
+            if (kern::topology::same_llc(cpu, victim) != (pass == 0))
+                continue;
+            if (__atomic_load_n(&cs(victim).rq.nr_queued, __ATOMIC_RELAXED) == 0)
+                continue;
+
+            runq_lock_pair(cpu, victim);
+            Thread *t = SchedPolicy::balance(cs(victim).rq.policy, cpu);
+            if (t)
+            {
+                dequeue_locked(victim, t);
+                renormalize(t, victim, cpu);
+                enqueue_locked(cpu, t, false);
+            }
+            runq_unlock_pair(cpu, victim);
+            if (t)
+                return true;
+        }
+    }
+    return false;
+}
+
+static inline bool idle_has_work(const CpuSched &c) noexcept
+{
+    return __atomic_load_n(&c.rq.nr_queued, __ATOMIC_RELAXED) != 0 ||
+           __atomic_load_n(&c.rq.dl_nr, __ATOMIC_RELAXED) != 0 ||
+           c.wake_tsc.load(std::memory_order_relaxed) != 0;
+}
+
+static void record_idle_wake(CpuSched &c, IdleMode mode) noexcept
+{
+    std::uint64_t kicked = c.wake_tsc.exchange(0, std::memory_order_acq_rel);
+    if (!kicked)
+        return;
+    std::uint64_t now = kern::arch::rdtsc();
+    std::uint64_t lat = now > kicked ? now - kicked : 0;
+    auto m = static_cast<std::size_t>(mode);
+    ++c.idle_stats.wakeups[m];
+    c.idle_stats.total[m] += lat;
+    if (lat > c.idle_stats.max[m])
+        c.idle_stats.max[m] = lat;
+}
+
+// Waits on an idle CPU until work may have arrived or an interrupt was
+// taken. Entered and left with interrupts off and no run-queue lock held.
+static void idle_wait(std::size_t cpu) noexcept
+{
+    CpuSched &c = cs(cpu);
+    c.idle_state.store(kIdlePolling, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    IdleMode mode = IdleMode::Poll;
+    std::uint64_t poll = kern::time::ns_to_cycles(kIdlePollNs);
+    std::uint64_t start = kern::arch::rdtsc();
+    while (!idle_has_work(c) && kern::arch::rdtsc() - start < poll)
+        asm volatile("pause");
+
+    if (!idle_has_work(c))
+    {
+        if (g_mwait.load(std::memory_order_relaxed))
+        {
+            // Arm the monitor before the last check, so a store that lands
+            // after the check still ends the MWAIT. ECX=1 lets interrupts end
+            // it while IF=0; the sti;nop;cli window then delivers them.
+            mode = IdleMode::Mwait;
+            c.idle_state.store(kIdleMwaiting, std::memory_order_relaxed);
+            asm volatile("monitor" ::"a"(&c.wake_tsc), "c"(0), "d"(0));
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (!idle_has_work(c))
+                asm volatile("mwait" ::"a"(0), "c"(1) : "memory");
+            asm volatile("sti; nop; cli" ::: "memory");
+        }
+        else
+        {
+            // sti;hlt back to back so the IPI cannot slip in before the hlt.
+            mode = IdleMode::Hlt;
+            c.idle_state.store(kIdleHalted, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (!idle_has_work(c))
+                asm volatile("sti; hlt" ::: "memory");
+            kern::interrupts::disable();
+        }
+    }
+
+    c.idle_state.store(kIdleRunning, std::memory_order_relaxed);
+    record_idle_wake(c, mode);
+}
+
+// Requeues the thread this CPU just switched away from. Runs on the incoming
+// thread's stack, so prev's context is fully saved and it is safe to hand it
+// to another CPU.
+extern "C" void sched_finish_switch() noexcept
+{
+    std::size_t cpu = cpu_index();
+    Thread *prev = cs(cpu).prev;
+    cs(cpu).prev = nullptr;
+    if (!prev || is_idle(prev) || prev->finished)
+        return;
+
+    // Parking: from here on unpark() has to queue it. If an unpark() already
+    // came, requeue it as usual.
+    std::uint8_t blocking = kBlocking;
+    if (prev->block_state.compare_exchange_strong(blocking, kBlocked, std::memory_order_acq_rel))
+        return;
+
+    std::size_t dst;
+    for (;;)
+    {
+        dst = requeue_target(prev, cpu);
+        runq_lock_pair(cpu, dst);
+        if (requeue_target(prev, cpu) == dst)
+            break;
+        runq_unlock_pair(cpu, dst);
+    }
+    prev->migrate_to = kNoCpu;
+    if (dst != cpu)
+        renormalize(prev, cpu, dst);
+    enqueue_locked(dst, prev, false);
+    runq_unlock_pair(cpu, dst);
+
+    if (dst != cpu)
+    {
+        kern::trace::emit(kern::trace::Event::Migrate, prev->id, static_cast<std::uint32_t>(dst));
+        kick_if_idle(dst);
+    }
+}
+
+static void switch_to(Context *save, Thread *prev, Thread *next) noexcept
+{
+    kern::fpu::switch_threads(prev, next);
+    context_switch(save, &next->ctx);
+    sched_finish_switch();
 }
 
 static void add_all_threads(Thread *t) noexcept
 {
-    all_lock();
+    // Readers walk the list without the lock (kern/rcu.hpp).
+    ListGuard guard(g_all_lock);
     t->all_next = g_all_threads;
-    g_all_threads = t;
-    all_unlock();
+    kern::rcu::assign(g_all_threads, t);
 }
 
-static std::size_t pick_target_cpu() noexcept
+// Prefers, in order: a CPU on an idle core, an idle SMT sibling, then the
+// least loaded CPU. Ties go to CPUs sharing our last-level cache, then
+// round-robin so bursts of creates spread out.
+static std::size_t pick_target_cpu(const CpuMask &mask) noexcept
 {
-    std::size_t count = g_cpu_count.load(std::memory_order_relaxed);
-    if (count == 0)
-        return cpu_index();
-    if (count > kMaxCpus)
-        count = kMaxCpus;
-
-    cpu_list_lock();
-    std::size_t idx = static_cast<std::size_t>(g_rr_counter.fetch_add(1, std::memory_order_relaxed)) % count;
-    std::size_t apic_id = static_cast<std::size_t>(g_cpu_list[idx]);
-    cpu_list_unlock();
-    return apic_id;
+    std::size_t count = online_count();
+    std::size_t here = cpu_index();
+    std::size_t start = g_rr_counter.fetch_add(1, std::memory_order_relaxed) % count;
+    std::size_t best = kNoCpu;
+    std::size_t best_score = ~std::size_t(0);
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        std::size_t cpu = (start + i) % count;
+        if (!mask.test(cpu))
+            continue;
+        std::size_t score = cpu_load(cpu) * 4;
+        if (!core_idle(cpu))
+            score += 2;
+        if (!kern::topology::same_llc(cpu, here))
+            score += 1;
+        if (score < best_score)
+        {
+            best = cpu;
+            best_score = score;
+        }
+    }
+    return best == kNoCpu ? here : best;
 }
 
 extern "C" void thread_entry_trampoline() noexcept
 {
-    auto *cur = g_current[cpu_index()];
+    auto *cur = kern::percpu::this_cpu()->sched.current;
     if (!cur || !cur->entry)
     {
         for (;;)
             asm volatile("hlt");
     }
+    sched_finish_switch();
     kern::interrupts::enable();
     cur->entry();
+    kern::trace::emit(kern::trace::Event::Exit, cur->id);
+    if (is_dl(cur))
+        set_deadline(cur, 0, 0, 0);
     cur->finished = true;
     yield();
     for (;;)
@@ -151,58 +659,104 @@ extern "C" void thread_entry_trampoline() noexcept
 
 void init() noexcept
 {
-    for (std::size_t i = 0; i < kMaxCpus; ++i)
-        g_runq_lock[i].clear(std::memory_order_release);
+    // The BSP runs on the static boot block until it registers.
+    auto *boot = kern::percpu::get(0);
+    kern::percpu::install(boot);
+    boot->sched.current = &boot->sched.idle;
 
-    g_current[0] = &g_bootstrap[0];
     g_all_threads = nullptr;
-    g_all_lock.clear(std::memory_order_release);
     g_rr_counter.store(0, std::memory_order_relaxed);
     g_cpu_count.store(0, std::memory_order_relaxed);
-    g_cpu_lock.clear(std::memory_order_release);
     g_apic_ready.store(false, std::memory_order_release);
+
+    // MWAIT idle needs MONITOR/MWAIT (CPUID.1:ECX[3]) and interrupts as
+    // break events while IF=0 (CPUID.5:ECX[1]).
+    bool mwait = false;
+    if (kern::arch::cpuid(0).eax >= 5 && (kern::arch::cpuid(1).ecx & (1u << 3)))
+        mwait = (kern::arch::cpuid(5).ecx & 0x3) == 0x3;
+    g_mwait_supported.store(mwait, std::memory_order_relaxed);
+    g_mwait.store(mwait, std::memory_order_relaxed);
+}
+
+std::size_t cpu_for_apic(std::uint32_t apic_id) noexcept
+{
+    kern::sync::SharedGuard guard(g_cpu_lock);
+    std::uint16_t cpu_plus1 = apic_slot(apic_id).cpu_plus1;
+    return cpu_plus1 ? cpu_plus1 - 1u : kNoCpu;
+}
+
+// Returns the logical index of `apic_id`, assigning one (and allocating the
+// CPU's per-CPU block) on first sight. An AP gets here on the early per-CPU
+// block, where the read side is off limits, so this always takes the write
+// side; it runs once or twice per CPU, at boot.
+static std::size_t register_apic(std::uint32_t apic_id) noexcept
+{
+    CpuListGuard guard(g_cpu_lock);
+    ApicSlot &slot = apic_slot(apic_id);
+    if (slot.cpu_plus1)
+        return slot.cpu_plus1 - 1u;
+    std::size_t count = g_cpu_count.load(std::memory_order_relaxed);
+    if (count >= kMaxCpus || !kern::percpu::create(count, apic_id))
+        return kNoCpu;
+
+    slot.apic_id = apic_id;
+    slot.cpu_plus1 = static_cast<std::uint16_t>(count + 1);
+    g_cpu_count.store(static_cast<unsigned>(count + 1), std::memory_order_release);
+    return count;
 }
 
 void init_cpu() noexcept
 {
-    g_current[cpu_index()] = &g_bootstrap[cpu_index()];
+    // An AP may run before the BSP has registered it.
+    std::size_t cpu = register_apic(hal::apic::lapic_id());
+    if (cpu == kNoCpu)
+    {
+        hal::console::write("sched: no per-CPU block for this CPU\n");
+        for (;;)
+            asm volatile("hlt");
+    }
+    auto *b = kern::percpu::get(cpu);
+    kern::percpu::install(b);
+    if (!b->sched.current)
+        b->sched.current = &b->sched.idle;
+    kern::topology::detect_current(cpu);
+    kern::trace::init_cpu();
+    kern::irqstat::init_cpu();
+    kern::deferred::init_cpu();
+    kern::rcu::init_cpu();
+    kern::smp::init_cpu();
 }
 
 void apic_ready() noexcept
 {
     g_apic_ready.store(true, std::memory_order_release);
-    std::size_t id = cpu_index();
-    if (!g_current[id])
-        g_current[id] = g_current[0];
 }
 
 void register_cpu(std::uint32_t apic_id) noexcept
 {
-    if (apic_id >= kMaxCpus)
-        return;
+    register_apic(apic_id);
+}
 
-    cpu_list_lock();
-    std::size_t count = g_cpu_count.load(std::memory_order_relaxed);
-    for (std::size_t i = 0; i < count; ++i)
-    {
-        if (g_cpu_list[i] == apic_id)
-        {
-            cpu_list_unlock();
-            return;
-        }
-    }
-    if (count >= kMaxCpus)
-    {
-        cpu_list_unlock();
-        return;
-    }
+std::size_t cpu_count() noexcept
+{
+    return online_count();
+}
+
+std::size_t current_cpu() noexcept
+{
+    return cpu_index();
+}
 
-    g_cpu_list[count] = apic_id;
-    g_cpu_count.store(static_cast<unsigned>(count + 1), std::memory_order_relaxed);
-    cpu_list_unlock();
+Thread *current() noexcept
+{
+    auto flags = kern::interrupts::save();
+    kern::interrupts::disable();
+    Thread *t = kern::percpu::this_cpu()->sched.current;
+    kern::interrupts::restore(flags);
+    return t;
 }
 
-Thread *create(ThreadFn fn, std::size_t stack_size) noexcept
+static Thread *alloc_thread(ThreadFn fn, std::size_t stack_size, std::uint32_t flags) noexcept
 {
     auto *t = reinterpret_cast<Thread *>(kern::mem::heap::kmalloc(sizeof(Thread), alignof(Thread)));
     if (!t)
@@ -215,11 +769,26 @@ Thread *create(ThreadFn fn, std::size_t stack_size) noexcept
         return nullptr;
     }
 
-    *t = {};
+    new (t) Thread{};
     t->entry = fn;
+    t->id = g_next_id.fetch_add(1, std::memory_order_relaxed);
+    t->wait_start = kern::arch::rdtsc();
     t->stack = stack;
     t->stack_size = stack_size;
 
+    if (flags & kThreadSimd)
+    {
+        t->fpu_state = kern::fpu::alloc_state();
+        if (!t->fpu_state)
+        {
+            kern::mem::heap::kfree(stack);
+            kern::mem::heap::kfree(t);
+            return nullptr;
+        }
+    }
+
+    SchedPolicy::init_thread(t);
+
     std::uintptr_t sp = reinterpret_cast<std::uintptr_t>(stack + stack_size);
     sp &= ~std::uintptr_t(0xF);
 
@@ -231,57 +800,804 @@ Thread *create(ThreadFn fn, std::size_t stack_size) noexcept
     t->ctx.rsp = sp;
     t->ctx.rip = reinterpret_cast<std::uint64_t>(&thread_entry_trampoline);
 
+    return t;
+}
+
+Thread *create(ThreadFn fn, std::size_t stack_size, std::uint32_t flags) noexcept
+{
+    Thread *t = alloc_thread(fn, stack_size, flags);
+    if (!t)
+        return nullptr;
+    std::size_t cpu = pick_target_cpu(t->affinity);
+    t->cpu.store(cpu, std::memory_order_relaxed);
+    add_all_threads(t);
+    kern::trace::emit(kern::trace::Event::Create, t->id, static_cast<std::uint32_t>(cpu));
+    enqueue(cpu, t, true);
+    return t;
+}
+
+Thread *create_on(std::size_t cpu, ThreadFn fn, std::size_t stack_size, std::uint32_t flags) noexcept
+{
+    if (cpu >= online_count())
+        return nullptr;
+    Thread *t = alloc_thread(fn, stack_size, flags);
+    if (!t)
+        return nullptr;
+    t->affinity = CpuMask::only(cpu);
+    t->cpu.store(cpu, std::memory_order_relaxed);
     add_all_threads(t);
-    push_runq(pick_target_cpu(), t);
+    kern::trace::emit(kern::trace::Event::Create, t->id, static_cast<std::uint32_t>(cpu));
+    enqueue(cpu, t, true);
     return t;
 }
 
+void set_weight(Thread *t, std::uint32_t weight) noexcept
+{
+    if (!t)
+        return;
+    if (weight < kMinWeight)
+        weight = kMinWeight;
+    if (weight > kMaxWeight)
+        weight = kMaxWeight;
+
+    auto flags = kern::interrupts::save();
+    kern::interrupts::disable();
+    std::size_t cpu = lock_thread_rq(t);
+    if (t->on_rq)
+        SchedPolicy::reweight(cs(cpu).rq.policy, t, weight);
+    t->weight = weight;
+    runq_unlock(cpu);
+    kern::interrupts::restore(flags);
+}
+
+// Caller holds the run-queue lock of `src` (and `dst` if different).
+static bool migrate_locked(Thread *t, std::size_t src, std::size_t dst) noexcept
+{
+    if (t->finished || is_idle(t) || is_dl(t))
+        return false;
+
+    if (t->on_rq)
+    {
+        if (src != dst)
+        {
+            dequeue_locked(src, t);
+            renormalize(t, src, dst);
+            enqueue_locked(dst, t, false);
+        }
+        return true;
+    }
+
+    // Running, or switched out but not yet requeued: sched_finish_switch()
+    // picks up migrate_to when the thread leaves its CPU.
+    t->migrate_to = dst == src && t->affinity.test(src) ? kNoCpu : dst;
+    return true;
+}
+
+bool set_affinity(Thread *t, const CpuMask &mask) noexcept
+{
+    if (!t || is_idle(t) || is_dl(t))
+        return false;
+
+    CpuMask m{};
+    std::size_t count = online_count();
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        if (mask.test(i))
+            m.set(i);
+    }
+    if (first_allowed(m, 0) == kNoCpu)
+        return false;
+
+    auto flags = kern::interrupts::save();
+    kern::interrupts::disable();
+    std::size_t src = lock_thread_rq(t);
+    t->affinity = m;
+    runq_unlock(src);
+    kern::interrupts::restore(flags);
+
+    if (m.test(src))
+        return true;
+    return migrate(t, first_allowed(m, src));
+}
+
+bool migrate(Thread *t, std::size_t dst) noexcept
+{
+    if (!t || dst >= online_count() || !t->affinity.test(dst))
+        return false;
+
+    auto flags = kern::interrupts::save();
+    kern::interrupts::disable();
+    std::size_t src;
+    for (;;)
+    {
+        src = t->cpu.load(std::memory_order_relaxed);
+        runq_lock_pair(src, dst);
+        if (t->cpu.load(std::memory_order_relaxed) == src)
+            break;
+        runq_unlock_pair(src, dst);
+    }
+    bool running = cs(src).current == t;
+    bool ok = migrate_locked(t, src, dst);
+    runq_unlock_pair(src, dst);
+    kern::interrupts::restore(flags);
+
+    if (!ok || src == dst)
+        return ok;
+    if (running)
+    {
+        // Force the thread off its CPU now instead of waiting for its slice.
+        if (src == cpu_index())
+            yield();
+        else
+            hal::apic::send_ipi(kern::percpu::get(src)->apic_id, kern::interrupts::kReschedVector);
+    }
+    else
+    {
+        kick_if_idle(dst);
+    }
+    return ok;
+}
+
+static void clear_deadline(Thread *t) noexcept
+{
+    auto flags = kern::interrupts::save();
+    kern::interrupts::disable();
+    std::size_t cpu = lock_thread_rq(t);
+    if (is_dl(t))
+    {
+        cs(cpu).rq.dl_bw -= dl_bw(t);
+        bool queued = t->on_rq;
+        if (queued)
+            dl_dequeue_locked(cpu, t);
+        t->dl_runtime = 0;
+        t->dl_budget = 0;
+        t->dl_overrun = false;
+        if (queued)
+            enqueue_locked(cpu, t, true);
+    }
+    runq_unlock(cpu);
+    kern::interrupts::restore(flags);
+}
+
+// Changes the parameters of a thread already in the deadline class, on the
+// CPU that admitted it.
+static bool update_deadline(Thread *t, std::uint64_t runtime, std::uint64_t deadline, std::uint64_t period) noexcept
+{
+    auto flags = kern::interrupts::save();
+    kern::interrupts::disable();
+    std::size_t cpu = lock_thread_rq(t);
+    RunQueue &rq = cs(cpu).rq;
+    std::uint64_t old_bw = dl_bw(t);
+    std::uint64_t new_bw = runtime * kBwOne / period;
+    bool ok = rq.dl_bw - old_bw + (new_bw ? new_bw : 1) <= kBwLimit;
+    if (ok)
+    {
+        bool queued = t->on_rq;
+        if (queued)
+            dl_dequeue_locked(cpu, t);
+        t->dl_runtime = runtime;
+        t->dl_deadline = deadline;
+        t->dl_period = period;
+        rq.dl_bw = rq.dl_bw - old_bw + dl_bw(t);
+        dl_start(t, kern::arch::rdtsc());
+        if (queued)
+            dl_enqueue_locked(cpu, t, kern::arch::rdtsc());
+    }
+    runq_unlock(cpu);
+    kern::interrupts::restore(flags);
+    return ok;
+}
+
+bool set_deadline(Thread *t, std::uint64_t runtime, std::uint64_t deadline, std::uint64_t period) noexcept
+{
+    if (!t || is_idle(t) || t->finished)
+        return false;
+    if (runtime == 0)
+    {
+        clear_deadline(t);
+        return true;
+    }
+    if (runtime > deadline || deadline > period)
+        return false;
+    runtime = kern::time::ns_to_cycles(runtime);
+    deadline = kern::time::ns_to_cycles(deadline);
+    period = kern::time::ns_to_cycles(period);
+    if (runtime == 0)
+        runtime = 1;
+    if (is_dl(t))
+        return update_deadline(t, runtime, deadline, period);
+
+    // Admission: reserve bandwidth on the first allowed CPU with room,
+    // starting with the one the thread is on.
+    std::uint64_t bw = runtime * kBwOne / period;
+    if (bw == 0)
+        bw = 1;
+    std::size_t count = online_count();
+    std::size_t start = t->cpu.load(std::memory_order_relaxed);
+    std::size_t target = kNoCpu;
+    auto flags = kern::interrupts::save();
+    kern::interrupts::disable();
+    for (std::size_t i = 0; i < count && target == kNoCpu; ++i)
+    {
+        std::size_t cpu = (start + i) % count;
+        if (!t->affinity.test(cpu))
+            continue;
+        runq_lock(cpu);
+        if (cs(cpu).rq.dl_bw + bw <= kBwLimit)
+        {
+            cs(cpu).rq.dl_bw += bw;
+            target = cpu;
+        }
+        runq_unlock(cpu);
+    }
+    kern::interrupts::restore(flags);
+    if (target == kNoCpu)
+        return false;
+
+    if (!set_affinity(t, CpuMask::only(target)))
+    {
+        flags = kern::interrupts::save();
+        kern::interrupts::disable();
+        runq_lock(target);
+        cs(target).rq.dl_bw -= bw;
+        runq_unlock(target);
+        kern::interrupts::restore(flags);
+        return false;
+    }
+
+    // A thread still in flight to `target` is requeued there by
+    // sched_finish_switch(), straight into the deadline queue.
+    flags = kern::interrupts::save();
+    kern::interrupts::disable();
+    std::size_t cpu = lock_thread_rq(t);
+    bool queued = t->on_rq;
+    if (queued)
+        dequeue_locked(cpu, t);
+    else if (cs(cpu).current == t)
+        update_curr(cs(cpu).rq, t, kern::arch::rdtsc()); // settle normal-class time first
+    t->dl_runtime = runtime;
+    t->dl_deadline = deadline;
+    t->dl_period = period;
+    dl_start(t, kern::arch::rdtsc());
+    if (queued)
+        enqueue_locked(cpu, t, false);
+    runq_unlock(cpu);
+    kern::interrupts::restore(flags);
+    return true;
+}
+
+void wait_next_period() noexcept
+{
+    kern::interrupts::disable();
+    std::size_t cpu = cpu_index();
+    Thread *t = cs(cpu).current;
+    if (is_dl(t))
+    {
+        runq_lock(cpu);
+        std::uint64_t now = kern::arch::rdtsc();
+        update_curr(cs(cpu).rq, t, now);
+        ++t->dl_jobs;
+        if (now > t->dl_abs_deadline)
+            ++t->dl_misses;
+        // Finished jobs are not overruns; sleep out the rest of the period.
+        t->dl_overrun = false;
+        t->dl_budget = 0;
+        runq_unlock(cpu);
+    }
+    yield();
+}
+
+DeadlineStats deadline_stats(const Thread *t) noexcept
+{
+    DeadlineStats s{};
+    if (t)
+    {
+        s.jobs = __atomic_load_n(&t->dl_jobs, __ATOMIC_RELAXED);
+        s.misses = __atomic_load_n(&t->dl_misses, __ATOMIC_RELAXED);
+    }
+    return s;
+}
+
+void dump_deadline_stats() noexcept
+{
+    kern::rcu::ReadGuard guard;
+    for (Thread *t = kern::rcu::dereference(g_all_threads); t; t = kern::rcu::dereference(t->all_next))
+    {
+        if (!is_dl(t) && t->dl_jobs == 0)
+            continue;
+        DeadlineStats s = deadline_stats(t);
+        hal::console::write("[dl] thread=");
+        hal::console::write_hex<std::uint32_t>(t->id);
+        hal::console::write(" jobs=");
+        hal::console::write_hex<std::uint64_t>(s.jobs);
+        hal::console::write(" misses=");
+        hal::console::write_hex<std::uint64_t>(s.misses);
+        hal::console::write("\n");
+    }
+}
+
+bool set_idle_mwait(bool enable) noexcept
+{
+    if (enable && !g_mwait_supported.load(std::memory_order_relaxed))
+        return false;
+    g_mwait.store(enable, std::memory_order_relaxed);
+    return true;
+}
+
+IdleStats idle_stats(std::size_t cpu) noexcept
+{
+    if (cpu >= online_count())
+        return {};
+    return cs(cpu).idle_stats;
+}
+
+void dump_idle_stats() noexcept
+{
+    static const char *const kModeNames[kIdleModes] = {"poll", "mwait", "hlt"};
+    std::size_t count = online_count();
+    for (std::size_t cpu = 0; cpu < count; ++cpu)
+    {
+        IdleStats s = idle_stats(cpu);
+        for (std::size_t m = 0; m < kIdleModes; ++m)
+        {
+            if (!s.wakeups[m])
+                continue;
+            hal::console::write("[idle] cpu=");
+            hal::console::write_hex<std::uint32_t>(static_cast<std::uint32_t>(cpu));
+            hal::console::write(" ");
+            hal::console::write(kModeNames[m]);
+            hal::console::write(" wakeups=");
+            hal::console::write_hex<std::uint64_t>(s.wakeups[m]);
+            hal::console::write(" avg=");
+            hal::console::write_hex<std::uint64_t>(s.total[m] / s.wakeups[m]);
+            hal::console::write(" max=");
+            hal::console::write_hex<std::uint64_t>(s.max[m]);
+            hal::console::write("\n");
+        }
+    }
+}
+
+ThreadTimes thread_times(const Thread *t) noexcept
+{
+    ThreadTimes r{};
+    if (!t)
+        return r;
+    r.run = __atomic_load_n(&t->run_time, __ATOMIC_RELAXED);
+    r.wait = __atomic_load_n(&t->wait_time, __ATOMIC_RELAXED);
+    r.voluntary = __atomic_load_n(&t->nvcsw, __ATOMIC_RELAXED);
+    r.involuntary = __atomic_load_n(&t->nivcsw, __ATOMIC_RELAXED);
+    r.last_cpu = __atomic_load_n(&t->last_cpu, __ATOMIC_RELAXED);
+    return r;
+}
+
+CpuTimes cpu_times(std::size_t cpu) noexcept
+{
+    if (cpu >= online_count())
+        return {};
+    const CpuTimes &t = cs(cpu).times;
+    CpuTimes r{};
+    r.busy = __atomic_load_n(&t.busy, __ATOMIC_RELAXED);
+    r.idle = __atomic_load_n(&t.idle, __ATOMIC_RELAXED);
+    r.irq = __atomic_load_n(&t.irq, __ATOMIC_RELAXED);
+    return r;
+}
+
+// Right-aligns to `width` columns.
+static void write_dec(std::uint64_t v, int width = 0) noexcept
+{
+    char buf[21];
+    int i = 20;
+    buf[i] = '\0';
+    do
+    {
+        buf[--i] = static_cast<char>('0' + v % 10);
+        v /= 10;
+    } while (v);
+    for (int pad = width - (20 - i); pad > 0; --pad)
+        hal::console::write(" ");
+    hal::console::write(buf + i);
+}
+
+// Rows shown by dump_top().
+constexpr std::size_t kTopRows = 16;
+
+void dump_top() noexcept
+{
+    std::size_t count = online_count();
+    for (std::size_t cpu = 0; cpu < count; ++cpu)
+    {
+        CpuTimes t = cpu_times(cpu);
+        std::uint64_t total = t.busy + t.idle;
+        hal::console::write("cpu");
+        write_dec(cpu);
+        hal::console::write(" busy=");
+        write_dec(total ? t.busy * 100 / total : 0);
+        hal::console::write("% irq=");
+        write_dec(total ? t.irq * 100 / total : 0);
+        hal::console::write("%\n");
+    }
+
+    // Keep the kTopRows threads with the most run time, sorted descending.
+    Thread *top[kTopRows] = {};
+    std::uint64_t run[kTopRows] = {};
+    std::size_t rows = 0;
+    kern::rcu::ReadGuard guard;
+    for (Thread *t = kern::rcu::dereference(g_all_threads); t; t = kern::rcu::dereference(t->all_next))
+    {
+        std::uint64_t r = __atomic_load_n(&t->run_time, __ATOMIC_RELAXED);
+        if (rows == kTopRows && r <= run[rows - 1])
+            continue;
+        std::size_t i = rows < kTopRows ? rows++ : rows - 1;
+        while (i > 0 && run[i - 1] < r)
+        {
+            top[i] = top[i - 1];
+            run[i] = run[i - 1];
+            --i;
+        }
+        top[i] = t;
+        run[i] = r;
+    }
+
+    hal::console::write("    TID  RUN(Kcyc) WAIT(Kcyc)    VOL  INVOL CPU\n");
+    for (std::size_t i = 0; i < rows; ++i)
+    {
+        ThreadTimes t = thread_times(top[i]);
+        write_dec(top[i]->id, 7);
+        write_dec(t.run / 1000, 11);
+        write_dec(t.wait / 1000, 11);
+        write_dec(t.voluntary, 7);
+        write_dec(t.involuntary, 7);
+        write_dec(t.last_cpu == kNoCpu ? 0 : t.last_cpu, 4);
+        hal::console::write(top[i]->finished ? " exited\n" : "\n");
+    }
+}
+
+// Run by an idle CPU whose whole core is idle: pulls one of two threads that
+// share a busy core, so SMT siblings stop competing while cores sit unused.
+static void pull_from_shared_core(std::size_t cpu) noexcept
+{
+    if (!core_idle(cpu))
+        return;
+
+    std::size_t count = online_count();
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        for (std::size_t i = 1; i < count; ++i)
+        {
+            std::size_t v = (cpu + i) % count;
+            if (kern::topology::same_llc(cpu, v) != (pass == 0) || kern::topology::same_core(cpu, v))
+                continue;
+            // Queued work is handled by stealing.
+            if (__atomic_load_n(&cs(v).rq.nr_queued, __ATOMIC_RELAXED) != 0)
+                continue;
+            Thread *t = __atomic_load_n(&cs(v).current, __ATOMIC_RELAXED);
+            if (!t || is_idle(t) || !t->affinity.test(cpu))
+                continue;
+
+            for (std::size_t j = 0; j < count; ++j)
+            {
+                if (j != v && kern::topology::same_core(v, j) && cpu_load(j) != 0)
+                {
+                    migrate(t, cpu);
+                    return;
+                }
+            }
+        }
+    }
+}
+
+void preempt_disable() noexcept
+{
+    asm volatile("incl %%gs:%c0" ::"i"(kern::percpu::kPreemptCountOffset) : "memory");
+}
+
+void preempt_enable() noexcept
+{
+    bool zero;
+    asm volatile("decl %%gs:%c1" : "=@ccz"(zero) : "i"(kern::percpu::kPreemptCountOffset) : "memory");
+    if (!zero)
+        return;
+    // Take a preemption deferred while the count was held. With interrupts
+    // off (RFLAGS.IF clear) the next tick takes it instead.
+    if (__atomic_load_n(&kern::percpu::this_cpu()->need_resched, __ATOMIC_RELAXED) &&
+        (kern::interrupts::save() & (1u << 9)))
+        yield();
+}
+
+std::uint64_t deferred_preemptions(std::size_t cpu) noexcept
+{
+    if (cpu >= online_count())
+        return 0;
+    return __atomic_load_n(&kern::percpu::get(cpu)->preempt_deferred, __ATOMIC_RELAXED);
+}
+
+// preempt_count lives in the CPU block, not the thread: switching away with
+// it held would leave the next thread on this CPU unpreemptible and stall
+// RCU there. Sleeping or yielding inside a SpinGuard is a bug; stop loudly.
+static void assert_preemptible(const char *what) noexcept
+{
+    std::uint32_t count = kern::percpu::this_cpu()->preempt_count;
+    if (count == 0)
+        return;
+    kern::interrupts::disable();
+    Thread *t = kern::percpu::this_cpu()->sched.current;
+    hal::console::write("sched: ");
+    hal::console::write(what);
+    hal::console::write(" with preemption disabled, count=");
+    hal::console::write_hex<std::uint32_t>(count);
+    hal::console::write(" thread=");
+    hal::console::write_hex<std::uint32_t>(t ? t->id : 0);
+    hal::console::write("\n");
+    for (;;)
+        asm volatile("hlt");
+}
+
 void yield() noexcept
 {
+    assert_preemptible("yield");
     kern::interrupts::disable();
+    kern::percpu::this_cpu()->need_resched = 0;
+    kern::rcu::quiescent();
     std::size_t cpu = cpu_index();
-    Thread *prev = g_current[cpu];
+    Thread *prev = cs(cpu).current;
+    bool live = !is_idle(prev) && !prev->finished;
 
-    // Put current back if it is a real thread and not finished.
-    if (prev && prev->entry && !prev->finished)
-        push_runq(cpu, prev);
+    runq_lock(cpu);
+    std::uint64_t now = kern::arch::rdtsc();
+    if (live)
+        update_curr(cs(cpu).rq, prev, now);
+    // A parking thread stays only if it was woken meanwhile.
+    bool runnable = live && prev->block_state.load(std::memory_order_acquire) != kBlocking;
 
-    Thread *next = pop_runq(cpu);
+    // Yielding hands the CPU to the most deserving other thread; prev is
+    // requeued only after the switch, so it cannot pick itself.
+    Thread *next = pick_next_locked(cpu);
+    if (!next && runnable && !must_leave(prev, cpu))
+    {
+        runq_unlock(cpu);
+        kern::interrupts::enable();
+        return;
+    }
+    if (!next && !is_idle(prev))
+        next = &cs(cpu).idle;
+
+    // Only the idle thread waits here, on its own stack.
     while (!next)
     {
+        runq_unlock(cpu);
+        kern::rcu::quiescent();
+        if (!steal_into(cpu))
+        {
+            // A pulled thread arrives later through kick_if_idle().
+            pull_from_shared_core(cpu);
+            idle_wait(cpu);
+        }
+        runq_lock(cpu);
+        next = pick_next_locked(cpu);
+    }
+    set_next_locked(cpu, prev, next, kern::arch::rdtsc());
+    std::uint32_t queued = static_cast<std::uint32_t>(cs(cpu).rq.nr_queued);
+    runq_unlock(cpu);
+
+    ++prev->nvcsw;
+    kern::trace::emit(kern::trace::Event::Switch, prev->id, next->id, queued);
+    switch_to(&prev->ctx, prev, next);
+    kern::interrupts::enable();
+}
+
+bool yield_to(Thread *t) noexcept
+{
+    if (!t)
+        return false;
+
+    kern::interrupts::disable();
+    std::size_t cpu = cpu_index();
+    Thread *prev = cs(cpu).current;
+    RunQueue &rq = cs(cpu).rq;
+
+    runq_lock(cpu);
+    bool ok = t != prev && !is_idle(prev) && !prev->finished && !is_dl(prev) && !is_dl(t) && t->on_rq &&
+              t->cpu.load(std::memory_order_relaxed) == cpu && !rq.dl_head;
+    if (!ok)
+    {
+        runq_unlock(cpu);
         kern::interrupts::enable();
-        asm volatile("hlt");
-        kern::interrupts::disable();
-        next = pop_runq(cpu);
+        return false;
     }
 
-    g_current[cpu] = next;
-    context_switch(&prev->ctx, &next->ctx);
+    // Take `t` straight out of the queue instead of waiting for its turn;
+    // prev is requeued after the switch as usual.
+    std::uint64_t now = kern::arch::rdtsc();
+    update_curr(rq, prev, now);
+    dequeue_locked(cpu, t);
+    std::uint64_t slice_start = rq.slice_start;
+    set_next_locked(cpu, prev, t, now);
+    rq.slice_start = slice_start; // t inherits what is left of prev's slice
+    std::uint32_t queued = static_cast<std::uint32_t>(rq.nr_queued);
+    runq_unlock(cpu);
+
+    ++prev->nvcsw;
+    kern::rcu::quiescent();
+    kern::trace::emit(kern::trace::Event::Switch, prev->id, t->id, queued);
+    switch_to(&prev->ctx, prev, t);
+    kern::interrupts::enable();
+    return true;
 }
 
-void yield_from_irq(kern::interrupts::Frame *frame) noexcept
+void park(std::uint64_t deadline) noexcept
 {
+    assert_preemptible("park");
     std::size_t cpu = cpu_index();
-    Thread *prev = g_current[cpu];
+    Thread *self = cs(cpu).current;
+    if (deadline)
+    {
+        runq_lock(cpu);
+        self->sleep_deadline = deadline;
+        self->sleep_cpu = cpu;
+        Thread **link = &cs(cpu).sleepers;
+        while (*link && (*link)->sleep_deadline <= deadline)
+            link = &(*link)->sleep_next;
+        self->sleep_next = *link;
+        *link = self;
+        runq_unlock(cpu);
+    }
+
+    yield();
 
-    if (!prev || !prev->entry || prev->finished)
+    // Woken some other way: take the timeout back off its list. sleep_cpu
+    // only changes under that CPU's run-queue lock.
+    kern::interrupts::disable();
+    std::size_t sc = __atomic_load_n(&self->sleep_cpu, __ATOMIC_RELAXED);
+    if (sc != kNoCpu)
+    {
+        runq_lock(sc);
+        if (self->sleep_cpu == sc)
+        {
+            Thread **link = &cs(sc).sleepers;
+            while (*link != self)
+                link = &(*link)->sleep_next;
+            *link = self->sleep_next;
+            self->sleep_next = nullptr;
+            self->sleep_cpu = kNoCpu;
+        }
+        runq_unlock(sc);
+    }
+    kern::interrupts::enable();
+}
+
+void unpark(Thread *t) noexcept
+{
+    auto flags = kern::interrupts::save();
+    kern::interrupts::disable();
+    std::uint8_t s = kBlocking;
+    bool parked = false;
+    // Still on its CPU: sched_finish_switch() (or yield() itself) sees the
+    // state change and keeps it runnable. Otherwise it is ours to queue.
+    if (!t->block_state.compare_exchange_strong(s, kRunnable, std::memory_order_acq_rel))
+        parked = s == kBlocked && t->block_state.compare_exchange_strong(s, kRunnable, std::memory_order_acq_rel);
+    if (!parked)
+    {
+        kern::interrupts::restore(flags);
         return;
+    }
 
-    prev->ctx.rsp = reinterpret_cast<std::uint64_t>(frame);
-    prev->ctx.rip = reinterpret_cast<std::uint64_t>(&irq_return_trampoline);
+    std::size_t src, dst;
+    for (;;)
+    {
+        src = t->cpu.load(std::memory_order_relaxed);
+        dst = requeue_target(t, src);
+        runq_lock_pair(src, dst);
+        if (t->cpu.load(std::memory_order_relaxed) == src && requeue_target(t, src) == dst)
+            break;
+        runq_unlock_pair(src, dst);
+    }
+    t->migrate_to = kNoCpu;
+    if (dst != src)
+        renormalize(t, src, dst);
+    t->wait_start = kern::arch::rdtsc();
+    enqueue_locked(dst, t, true);
+    runq_unlock_pair(src, dst);
+    kern::trace::emit(kern::trace::Event::Wakeup, t->id, static_cast<std::uint32_t>(dst));
+    kern::interrupts::restore(flags);
+    kick_if_idle(dst);
+}
+
+void irq_enter() noexcept
+{
+    CpuSched &c = kern::percpu::this_cpu()->sched;
+    if (!c.irq_enter)
+        c.irq_enter = kern::arch::rdtsc();
+}
+
+void irq_exit() noexcept
+{
+    CpuSched &c = kern::percpu::this_cpu()->sched;
+    if (c.irq_enter)
+    {
+        c.times.irq += kern::arch::rdtsc() - c.irq_enter;
+        c.irq_enter = 0;
+    }
+}
+
+bool irq_should_preempt() noexcept
+{
+    // A preemption never returns to the interrupt entry, so close the IRQ here.
+    irq_exit();
+    std::size_t cpu = cpu_index();
+    Thread *prev = cs(cpu).current;
+
+    // The idle thread wakes from hlt and picks work itself.
+    if (!prev || is_idle(prev) || prev->finished)
+        return false;
 
     runq_lock(cpu);
-    push_runq_locked(cpu, prev);
-    Thread *next = pop_runq_locked(cpu);
+    RunQueue &rq = cs(cpu).rq;
+    std::uint64_t now = kern::arch::rdtsc();
+    update_curr(rq, prev, now);
+    wake_sleepers_locked(cpu, now);
+    dl_wake_due(rq, now);
+
+    // Deadline threads run until their budget is gone or an earlier deadline
+    // arrives; normal threads until the policy ends their slice or a deadline
+    // thread is ready.
+    bool leave = must_leave(prev, cpu);
+    if (!leave && is_dl(prev))
+        leave = rq.dl_head && rq.dl_head->dl_abs_deadline < prev->dl_abs_deadline;
+    else if (!leave)
+        leave = rq.dl_head ||
+                (rq.nr_queued && SchedPolicy::tick(rq.policy, prev, rq.nr_queued, now - rq.slice_start));
+    if (!leave)
+    {
+        runq_unlock(cpu);
+        return false;
+    }
+
+    // The thread holds a spinlock or similar: switch when it lets go.
+    auto *self = kern::percpu::this_cpu();
+    if (self->preempt_count)
+    {
+        self->need_resched = 1;
+        ++self->preempt_deferred;
+        runq_unlock(cpu);
+        return false;
+    }
     runq_unlock(cpu);
-    if (!next)
+    return true;
+}
+
+void preempt_from_irq(kern::interrupts::Frame *frame) noexcept
+{
+    std::size_t cpu = cpu_index();
+    Thread *prev = cs(cpu).current;
+
+    // The queue may have been stolen from since irq_should_preempt(); then
+    // prev keeps the CPU unless it has to leave anyway.
+    runq_lock(cpu);
+    std::uint64_t now = kern::arch::rdtsc();
+    update_curr(cs(cpu).rq, prev, now);
+    Thread *next = pick_next_locked(cpu);
+    if (!next && !must_leave(prev, cpu))
+    {
+        runq_unlock(cpu);
         return;
+    }
+    if (!next)
+        next = &cs(cpu).idle;
+    set_next_locked(cpu, prev, next, now);
+    std::uint32_t queued = static_cast<std::uint32_t>(cs(cpu).rq.nr_queued);
+    runq_unlock(cpu);
+
+    ++prev->nivcsw;
+    kern::rcu::quiescent();
+    kern::trace::emit(kern::trace::Event::Preempt, prev->id, next->id, queued);
+    prev->ctx.rsp = reinterpret_cast<std::uint64_t>(frame);
+    prev->ctx.rip = reinterpret_cast<std::uint64_t>(&irq_return_trampoline);
 
-    g_current[cpu] = next;
     Context tmp{};
-    context_switch(&tmp, &next->ctx);
+    switch_to(&tmp, prev, next);
 }
 
+// The boot context of each CPU becomes its idle thread.
 void run() noexcept
 {
     for (;;)
@@ -0,0 +1,204 @@
+#include "kern/arch/sched.hpp"
+#include "kern/arch/sched_policy.hpp"
+#include "kern/time.hpp"
+#include <atomic>
+#include <cstdint>
+
+namespace kern::sched
+{
+
+// Tunables, in nanoseconds.
+constexpr std::uint64_t kSchedLatencyNs = 6'000'000;
+constexpr std::uint64_t kMinGranularityNs = 750'000;
+
+static std::atomic_uint g_prio_seed = 0x9E3779B9u;
+
+static inline bool vr_less(const Thread *a, const Thread *b) noexcept
+{
+    if (a->vruntime != b->vruntime)
+        return a->vruntime < b->vruntime;
+    return reinterpret_cast<std::uintptr_t>(a) < reinterpret_cast<std::uintptr_t>(b);
+}
+
+static Thread *rotate_right(Thread *t) noexcept
+{
+    Thread *l = t->rq_left;
+    t->rq_left = l->rq_right;
+    l->rq_right = t;
+    return l;
+}
+
+static Thread *rotate_left(Thread *t) noexcept
+{
+    Thread *r = t->rq_right;
+    t->rq_right = r->rq_left;
+    r->rq_left = t;
+    return r;
+}
+
+static Thread *tree_insert(Thread *root, Thread *t) noexcept
+{
+    if (!root)
+        return t;
+    if (vr_less(t, root))
+    {
+        root->rq_left = tree_insert(root->rq_left, t);
+        if (root->rq_left->rq_prio > root->rq_prio)
+            root = rotate_right(root);
+    }
+    else
+    {
+        root->rq_right = tree_insert(root->rq_right, t);
+        if (root->rq_right->rq_prio > root->rq_prio)
+            root = rotate_left(root);
+    }
+    return root;
+}
+
+// Joins two treaps where every key in `a` is smaller than every key in `b`.
+static Thread *tree_merge(Thread *a, Thread *b) noexcept
+{
+    if (!a)
+        return b;
+    if (!b)
+        return a;
+    if (a->rq_prio > b->rq_prio)
+    {
+        a->rq_right = tree_merge(a->rq_right, b);
+        return a;
+    }
+    b->rq_left = tree_merge(a, b->rq_left);
+    return b;
+}
+
+static Thread *tree_erase(Thread *root, Thread *t) noexcept
+{
+    if (!root)
+        return nullptr;
+    if (root == t)
+        return tree_merge(t->rq_left, t->rq_right);
+    if (vr_less(t, root))
+        root->rq_left = tree_erase(root->rq_left, t);
+    else
+        root->rq_right = tree_erase(root->rq_right, t);
+    return root;
+}
+
+static Thread *tree_leftmost(Thread *root) noexcept
+{
+    if (!root)
+        return nullptr;
+    while (root->rq_left)
+        root = root->rq_left;
+    return root;
+}
+
+// Finds the first queued thread (in vruntime order) allowed on `cpu`.
+static Thread *tree_find_allowed(Thread *root, std::size_t cpu) noexcept
+{
+    if (!root)
+        return nullptr;
+    if (Thread *t = tree_find_allowed(root->rq_left, cpu))
+        return t;
+    if (root->affinity.test(cpu))
+        return root;
+    return tree_find_allowed(root->rq_right, cpu);
+}
+
+static void update_min_vruntime(FairPolicy::Queue &q, const Thread *cur) noexcept
+{
+    std::uint64_t v = q.min_vruntime;
+    const Thread *left = tree_leftmost(q.root);
+    if (cur && left)
+        v = cur->vruntime < left->vruntime ? cur->vruntime : left->vruntime;
+    else if (cur)
+        v = cur->vruntime;
+    else if (left)
+        v = left->vruntime;
+
+    // min_vruntime only moves forward.
+    if (v > q.min_vruntime)
+        q.min_vruntime = v;
+}
+
+void FairPolicy::init_thread(Thread *t) noexcept
+{
+    // Treap priority: any well-mixed value works.
+    std::uint32_t x = g_prio_seed.fetch_add(0x9E3779B9u, std::memory_order_relaxed);
+    x ^= x >> 16;
+    x *= 0x45D9F3Bu;
+    x ^= x >> 16;
+    t->rq_prio = x;
+}
+
+// `place` is set for threads arriving from elsewhere (new or moved): they
+// start at the queue's min_vruntime instead of with stale credit.
+void FairPolicy::enqueue(Queue &q, Thread *t, bool place) noexcept
+{
+    if (place && t->vruntime < q.min_vruntime)
+        t->vruntime = q.min_vruntime;
+    t->rq_left = nullptr;
+    t->rq_right = nullptr;
+    q.root = tree_insert(q.root, t);
+    q.load += t->weight;
+}
+
+void FairPolicy::dequeue(Queue &q, Thread *t) noexcept
+{
+    q.root = tree_erase(q.root, t);
+    q.load -= t->weight;
+    t->rq_left = nullptr;
+    t->rq_right = nullptr;
+}
+
+Thread *FairPolicy::pick_next(const Queue &q) noexcept
+{
+    return tree_leftmost(q.root);
+}
+
+void FairPolicy::charge(Queue &q, Thread *t, std::uint64_t delta) noexcept
+{
+    t->vruntime += delta * kDefaultWeight / t->weight;
+    update_min_vruntime(q, t);
+}
+
+void FairPolicy::set_next(Queue &q, const Thread *t) noexcept
+{
+    update_min_vruntime(q, t);
+}
+
+// The ideal slice is the latency period split by weight. The period grows
+// once there are more runnable threads than fit at minimum granularity.
+bool FairPolicy::tick(const Queue &q, const Thread *t, std::size_t queued, std::uint64_t ran) noexcept
+{
+    std::uint64_t min_gran = kern::time::ns_to_cycles(kMinGranularityNs);
+    std::uint64_t nr = queued + 1;
+    std::uint64_t period = kern::time::ns_to_cycles(kSchedLatencyNs);
+    if (nr * min_gran > period)
+        period = nr * min_gran;
+    std::uint64_t total = q.load + t->weight;
+    std::uint64_t slice = period * t->weight / total;
+    if (slice < min_gran)
+        slice = min_gran;
+    return ran >= slice;
+}
+
+Thread *FairPolicy::balance(const Queue &q, std::size_t cpu) noexcept
+{
+    return tree_find_allowed(q.root, cpu);
+}
+
+// Moves the thread's vruntime from one queue's timeline to the other's.
+void FairPolicy::move(Thread *t, const Queue &from, const Queue &to) noexcept
+{
+    std::uint64_t base = from.min_vruntime;
+    std::uint64_t lag = t->vruntime > base ? t->vruntime - base : 0;
+    t->vruntime = to.min_vruntime + lag;
+}
+
+void FairPolicy::reweight(Queue &q, const Thread *t, std::uint32_t weight) noexcept
+{
+    q.load = q.load - t->weight + weight;
+}
+
+} // namespace kern::sched
@@ -0,0 +1,79 @@
+#include "kern/arch/sched.hpp"
+#include "kern/arch/sched_policy.hpp"
+#include "kern/time.hpp"
+#include <cstdint>
+
+namespace kern::sched
+{
+
+// Slice per turn.
+constexpr std::uint64_t kRrSliceNs = 2'000'000;
+
+void RoundRobinPolicy::init_thread(Thread *) noexcept
+{
+}
+
+// Arrivals and requeued threads alike go to the back.
+void RoundRobinPolicy::enqueue(Queue &q, Thread *t, bool) noexcept
+{
+    t->rq_left = q.tail;
+    t->rq_right = nullptr;
+    if (q.tail)
+        q.tail->rq_right = t;
+    else
+        q.head = t;
+    q.tail = t;
+}
+
+void RoundRobinPolicy::dequeue(Queue &q, Thread *t) noexcept
+{
+    if (t->rq_left)
+        t->rq_left->rq_right = t->rq_right;
+    else
+        q.head = t->rq_right;
+    if (t->rq_right)
+        t->rq_right->rq_left = t->rq_left;
+    else
+        q.tail = t->rq_left;
+    t->rq_left = nullptr;
+    t->rq_right = nullptr;
+}
+
+Thread *RoundRobinPolicy::pick_next(const Queue &q) noexcept
+{
+    return q.head;
+}
+
+void RoundRobinPolicy::charge(Queue &, Thread *, std::uint64_t) noexcept
+{
+}
+
+void RoundRobinPolicy::set_next(Queue &, const Thread *) noexcept
+{
+}
+
+bool RoundRobinPolicy::tick(const Queue &, const Thread *, std::size_t, std::uint64_t ran) noexcept
+{
+    return ran >= kern::time::ns_to_cycles(kRrSliceNs);
+}
+
+// The thread that has waited longest among those allowed on `cpu`.
+Thread *RoundRobinPolicy::balance(const Queue &q, std::size_t cpu) noexcept
+{
+    for (Thread *t = q.head; t; t = t->rq_right)
+    {
+        if (t->affinity.test(cpu))
+            return t;
+    }
+    return nullptr;
+}
+
+void RoundRobinPolicy::move(Thread *, const Queue &, const Queue &) noexcept
+{
+}
+
+void RoundRobinPolicy::reweight(Queue &, const Thread *, std::uint32_t) noexcept
+{
+}
+
+} // namespace kern::sched
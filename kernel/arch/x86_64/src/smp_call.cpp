@@ -0,0 +1,220 @@
+#include "hal/apic.hpp"
+#include "hal/console.hpp"
+#include "kern/arch/interrupts.hpp"
+#include "kern/arch/percpu.hpp"
+#include "kern/interrupts.hpp"
+#include "kern/mem/heap.hpp"
+#include "kern/sched.hpp"
+#include "kern/smp.hpp"
+#include "kern/sync/spinlock.hpp"
+#include <atomic>
+#include <cstdint>
+#include <new>
+
+namespace kern::smp
+{
+
+using kern::sched::CpuMask;
+using kern::sched::kMaxCpus;
+
+// One CPU's request to one target. The sender may refill it once `busy` is
+// clear, which the target does after fn has returned.
+struct Request
+{
+    Request *next;
+    CallFn fn;
+    void *arg;
+    std::atomic_bool busy;
+};
+
+struct CallQueue
+{
+    // Pushed by senders, newest first; the IPI handler takes the whole list.
+    // A push that finds it empty is the one that sends the IPI.
+    alignas(64) std::atomic<Request *> pending{nullptr};
+    // Owner-only from here on (the handler runs on the owner too).
+    alignas(64) Stats stats{};
+    Request slots[kMaxCpus]; // this CPU's request to each target
+};
+
+static inline CallQueue *queue_of(std::size_t cpu) noexcept
+{
+    return __atomic_load_n(&kern::percpu::get(cpu)->smp_call, __ATOMIC_ACQUIRE);
+}
+
+// Links `r` into `q`. Returns true if the queue was empty, so the target
+// needs an IPI; otherwise one is already on its way.
+static bool push(CallQueue *q, Request *r) noexcept
+{
+    Request *head = q->pending.load(std::memory_order_relaxed);
+    do
+        r->next = head;
+    while (!q->pending.compare_exchange_weak(head, r, std::memory_order_release, std::memory_order_relaxed));
+    return head == nullptr;
+}
+
+bool call(const CpuMask &mask, CallFn fn, void *arg, bool wait) noexcept
+{
+    if (!fn)
+        return false;
+    kern::sched::preempt_disable();
+    auto *self = kern::percpu::this_cpu();
+    CallQueue *q = self->smp_call;
+    if (!q)
+    {
+        kern::sched::preempt_enable();
+        return false;
+    }
+
+    std::size_t me = self->index;
+    std::size_t count = kern::sched::cpu_count();
+    CpuMask kick;
+    std::size_t targets = 0;
+    bool all_others = true;
+    bool any_kick = false;
+    bool skipped = false;
+    for (std::size_t cpu = 0; cpu < count; ++cpu)
+    {
+        if (cpu == me)
+            continue;
+        CallQueue *tq = mask.test(cpu) ? queue_of(cpu) : nullptr;
+        if (!tq)
+        {
+            skipped = skipped || mask.test(cpu);
+            all_others = false;
+            continue;
+        }
+        Request &r = q->slots[cpu];
+        while (r.busy.load(std::memory_order_acquire))
+            kern::sync::cpu_relax();
+        r.fn = fn;
+        r.arg = arg;
+        r.busy.store(true, std::memory_order_relaxed);
+        ++targets;
+        ++q->stats.requests;
+        if (push(tq, &r))
+        {
+            kick.set(cpu);
+            any_kick = true;
+        }
+    }
+
+    if (any_kick && all_others && targets > 1)
+    {
+        hal::apic::send_ipi_all_but_self(kern::interrupts::kCallVector);
+        ++q->stats.ipis_sent;
+    }
+    else if (any_kick)
+    {
+        for (std::size_t cpu = 0; cpu < count; ++cpu)
+        {
+            if (!kick.test(cpu))
+                continue;
+            hal::apic::send_ipi(kern::percpu::get(cpu)->apic_id, kern::interrupts::kCallVector);
+            ++q->stats.ipis_sent;
+        }
+    }
+
+    if (mask.test(me))
+    {
+        auto flags = kern::interrupts::save();
+        kern::interrupts::disable();
+        fn(arg);
+        kern::interrupts::restore(flags);
+    }
+
+    if (wait)
+    {
+        for (std::size_t cpu = 0; cpu < count; ++cpu)
+        {
+            if (cpu == me || !mask.test(cpu))
+                continue;
+            while (q->slots[cpu].busy.load(std::memory_order_acquire))
+                kern::sync::cpu_relax();
+        }
+    }
+    kern::sched::preempt_enable();
+    return !skipped;
+}
+
+void handle_call_ipi() noexcept
+{
+    CallQueue *q = kern::percpu::this_cpu()->smp_call;
+    if (!q)
+        return;
+    ++q->stats.ipis;
+
+    // Take everything queued so far and run it oldest first. Requests
+    // pushed meanwhile found the list empty and sent another IPI.
+    Request *r = q->pending.exchange(nullptr, std::memory_order_acquire);
+    Request *fifo = nullptr;
+    while (r)
+    {
+        Request *next = r->next;
+        r->next = fifo;
+        fifo = r;
+        r = next;
+    }
+    while (fifo)
+    {
+        // The sender may reuse the request as soon as busy drops.
+        Request *next = fifo->next;
+        fifo->fn(fifo->arg);
+        fifo->busy.store(false, std::memory_order_release);
+        ++q->stats.served;
+        fifo = next;
+    }
+}
+
+void init_cpu() noexcept
+{
+    auto *b = kern::percpu::this_cpu();
+    if (b->smp_call)
+        return;
+    void *mem = kern::mem::heap::kmalloc(sizeof(CallQueue), alignof(CallQueue));
+    if (!mem)
+        return;
+    auto *q = new (mem) CallQueue;
+    for (auto &r : q->slots)
+        r.busy.store(false, std::memory_order_relaxed);
+    __atomic_store_n(&b->smp_call, q, __ATOMIC_RELEASE);
+}
+
+Stats stats(std::size_t cpu) noexcept
+{
+    if (cpu >= kern::sched::cpu_count())
+        return {};
+    CallQueue *q = queue_of(cpu);
+    if (!q)
+        return {};
+    Stats s{};
+    s.requests = __atomic_load_n(&q->stats.requests, __ATOMIC_RELAXED);
+    s.ipis_sent = __atomic_load_n(&q->stats.ipis_sent, __ATOMIC_RELAXED);
+    s.ipis = __atomic_load_n(&q->stats.ipis, __ATOMIC_RELAXED);
+    s.served = __atomic_load_n(&q->stats.served, __ATOMIC_RELAXED);
+    return s;
+}
+
+void dump_stats() noexcept
+{
+    std::size_t count = kern::sched::cpu_count();
+    for (std::size_t cpu = 0; cpu < count; ++cpu)
+    {
+        Stats s = stats(cpu);
+        if (!s.requests && !s.ipis)
+            continue;
+        hal::console::write("[smp_call] cpu=");
+        hal::console::write_hex<std::uint32_t>(static_cast<std::uint32_t>(cpu));
+        hal::console::write(" requests=");
+        hal::console::write_hex<std::uint64_t>(s.requests);
+        hal::console::write(" ipis_sent=");
+        hal::console::write_hex<std::uint64_t>(s.ipis_sent);
+        hal::console::write(" ipis=");
+        hal::console::write_hex<std::uint64_t>(s.ipis);
+        hal::console::write(" served=");
+        hal::console::write_hex<std::uint64_t>(s.served);
+        hal::console::write("\n");
+    }
+}
+
+} // namespace kern::smp
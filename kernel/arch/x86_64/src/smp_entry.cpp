@@ -1,14 +1,19 @@
 #include "hal/apic.hpp"
 #include "hal/console.hpp"
+#include "kern/arch/percpu.hpp"
+#include "kern/fpu.hpp"
 #include "kern/interrupts.hpp"
 #include "kern/sched.hpp"
 #include "kern/smp.hpp"
+#include "kern/time.hpp"
 
 namespace kern::smp
 {
 
 extern "C" void ap_entry(std::uint32_t apic_id) noexcept
 {
+    kern::percpu::install_early();
+
     // Basic proof: AP is alive.
     hal::console::write("AP online, apic id=");
     hal::console::write_hex<std::uint32_t>(apic_id);
@@ -17,7 +22,9 @@ extern "C" void ap_entry(std::uint32_t apic_id) noexcept
     hal::apic::enable_local();
     kern::interrupts::init();
     kern::sched::init_cpu();
+    kern::fpu::init_cpu();
     kern::interrupts::enable();
+    kern::time::sync_cpu();
     kern::sched::run();
 }
 
@@ -0,0 +1,222 @@
+#include "kern/task.hpp"
+#include "kern/arch/cpu.hpp"
+#include "kern/sched.hpp"
+#include "kern/sync/spinlock.hpp"
+#include "kern/time.hpp"
+#include <atomic>
+#include <cstdint>
+#include <utility>
+
+namespace kern
+{
+namespace exec
+{
+
+// Tasks resumed per pass before the executor lets threads on its CPU run.
+constexpr int kBatch = 64;
+
+struct Executor
+{
+    kern::sync::TicketLock lock{"executor"};
+    WaitNode *ready_head{nullptr};
+    WaitNode *ready_tail{nullptr};
+    WaitNode *sleepers{nullptr}; // sorted by wake_tsc
+    // Bumped by schedule(); the executor thread waits on it when idle.
+    std::uint32_t seq{0};
+    std::atomic<kern::sched::Thread *> thread{nullptr};
+    std::atomic_bool starting{false};
+};
+
+static Executor g_exec[kern::sched::kMaxCpus];
+
+// Queues are touched from interrupt handlers too, so lock with IRQs off.
+using Guard = kern::sync::IrqSpinGuard<kern::sync::TicketLock>;
+
+static void push_ready_locked(Executor &ex, WaitNode *n) noexcept
+{
+    n->next = nullptr;
+    if (ex.ready_tail)
+        ex.ready_tail->next = n;
+    else
+        ex.ready_head = n;
+    ex.ready_tail = n;
+}
+
+static WaitNode *pop_ready_locked(Executor &ex) noexcept
+{
+    WaitNode *n = ex.ready_head;
+    if (n)
+    {
+        ex.ready_head = n->next;
+        if (!ex.ready_head)
+            ex.ready_tail = nullptr;
+    }
+    return n;
+}
+
+static void wake_sleepers_locked(Executor &ex, std::uint64_t now) noexcept
+{
+    while (ex.sleepers && ex.sleepers->wake_tsc <= now)
+    {
+        WaitNode *n = ex.sleepers;
+        ex.sleepers = n->next;
+        push_ready_locked(ex, n);
+    }
+}
+
+std::size_t this_executor() noexcept
+{
+    return kern::sched::current_cpu();
+}
+
+void schedule(WaitNode *n) noexcept
+{
+    Executor &ex = g_exec[n->cpu];
+    {
+        Guard guard(ex.lock);
+        push_ready_locked(ex, n);
+        __atomic_store_n(&ex.seq, ex.seq + 1, __ATOMIC_RELEASE);
+    }
+    kern::sched::wake(&ex.seq, 1);
+}
+
+// Only tasks on `n->cpu` sleep there, so its executor is running and will
+// see the new sleeper before it next waits.
+void sleep(WaitNode *n) noexcept
+{
+    Executor &ex = g_exec[n->cpu];
+    Guard guard(ex.lock);
+    WaitNode **link = &ex.sleepers;
+    while (*link && (*link)->wake_tsc <= n->wake_tsc)
+        link = &(*link)->next;
+    n->next = *link;
+    *link = n;
+}
+
+// Body of each CPU's executor thread. Tasks run on this thread's stack one at
+// a time; a task that suspends leaves only its frame behind.
+static void executor_main() noexcept
+{
+    Executor &ex = g_exec[kern::sched::current_cpu()];
+    for (;;)
+    {
+        for (int i = 0; i < kBatch; ++i)
+        {
+            WaitNode *n;
+            {
+                Guard guard(ex.lock);
+                wake_sleepers_locked(ex, kern::arch::rdtsc());
+                n = pop_ready_locked(ex);
+            }
+            if (!n)
+                break;
+            // The frame, and `n` with it, may be gone once this returns.
+            n->handle.resume();
+        }
+
+        kern::sched::yield();
+
+        // Nothing ready: block until schedule() bumps seq or the first
+        // sleeper is due. wait_on() returns at once if seq moved since we
+        // looked, so a wakeup cannot slip in between.
+        std::uint32_t seen;
+        std::uint64_t timeout = 0;
+        bool idle;
+        {
+            Guard guard(ex.lock);
+            seen = ex.seq;
+            std::uint64_t now = kern::arch::rdtsc();
+            idle = !ex.ready_head && (!ex.sleepers || ex.sleepers->wake_tsc > now);
+            if (idle && ex.sleepers)
+                timeout = kern::time::cycles_to_ns(ex.sleepers->wake_tsc - now) + 1;
+        }
+        if (idle)
+            kern::sched::wait_on(&ex.seq, seen, timeout);
+    }
+}
+
+static bool ensure_executor(std::size_t cpu) noexcept
+{
+    Executor &ex = g_exec[cpu];
+    if (ex.thread.load(std::memory_order_acquire))
+        return true;
+    bool expected = false;
+    if (!ex.starting.compare_exchange_strong(expected, true, std::memory_order_acq_rel))
+        return true; // another spawn is creating it; queued tasks wait for it
+
+    kern::sched::Thread *t = kern::sched::create_on(cpu, executor_main);
+    if (!t)
+    {
+        ex.starting.store(false, std::memory_order_release);
+        return false;
+    }
+    ex.thread.store(t, std::memory_order_release);
+    return true;
+}
+
+} // namespace exec
+
+bool spawn_on(std::size_t cpu, task<void> t) noexcept
+{
+    if (!t.valid() || cpu >= kern::sched::cpu_count() || !exec::ensure_executor(cpu))
+        return false;
+
+    auto h = t.release();
+    auto &p = h.promise();
+    p.detached = true;
+    p.node.handle = h;
+    p.node.cpu = cpu;
+    exec::schedule(&p.node);
+    return true;
+}
+
+bool spawn(task<void> t) noexcept
+{
+    return spawn_on(kern::sched::current_cpu(), std::move(t));
+}
+
+void task_sleep::await_suspend(std::coroutine_handle<> h) noexcept
+{
+    node.handle = h;
+    node.cpu = exec::this_executor();
+    node.wake_tsc = kern::arch::rdtsc() + kern::time::ns_to_cycles(ns);
+    exec::sleep(&node);
+}
+
+void AsyncEvent::set() noexcept
+{
+    exec::WaitNode *w;
+    {
+        exec::Guard guard(lock_);
+        set_.store(true, std::memory_order_release);
+        w = waiters_;
+        waiters_ = nullptr;
+    }
+
+    while (w)
+    {
+        exec::WaitNode *next = w->next;
+        exec::schedule(w);
+        w = next;
+    }
+}
+
+void AsyncEvent::reset() noexcept
+{
+    exec::Guard guard(lock_);
+    set_.store(false, std::memory_order_relaxed);
+}
+
+bool AsyncEvent::enqueue(exec::WaitNode *n) noexcept
+{
+    exec::Guard guard(lock_);
+    bool queued = !set_.load(std::memory_order_relaxed);
+    if (queued)
+    {
+        n->next = waiters_;
+        waiters_ = n;
+    }
+    return queued;
+}
+
+} // namespace kern
@@ -0,0 +1,191 @@
+#include "kern/time.hpp"
+#include "hal/apic.hpp"
+#include "hal/console.hpp"
+#include "hal/tsc.hpp"
+#include "kern/arch/cpu.hpp"
+#include "kern/arch/interrupts.hpp"
+#include "kern/arch/percpu.hpp"
+#include "kern/sched.hpp"
+#include "kern/smp.hpp"
+#include "kern/sync/seqlock.hpp"
+#include "kern/trace.hpp"
+#include <atomic>
+#include <cstdint>
+
+namespace kern::time
+{
+
+// Rates are fixed point: x * mult >> kShift.
+constexpr unsigned kShift = 32;
+constexpr std::uint64_t kDefaultKhz = 3'000'000;
+// Cross-CPU round trips per sync_cpu(); the fastest one is used.
+constexpr int kSyncRounds = 4;
+
+// ns = ns_base + (tsc - tsc_base) * mult >> kShift, tsc on the boot CPU's
+// timeline.
+struct Clock
+{
+    std::uint64_t tsc_base;
+    std::uint64_t ns_base;
+    std::uint64_t mult;
+};
+
+static kern::sync::SeqLock g_clock_lock{"clock"};
+static Clock g_clock{0, 0, (1'000'000ull << kShift) / kDefaultKhz};
+// The same rate for durations, read without the seqlock.
+static std::atomic<std::uint64_t> g_ns_mult = (1'000'000ull << kShift) / kDefaultKhz;
+static std::atomic<std::uint64_t> g_cyc_mult = (kDefaultKhz << kShift) / 1'000'000;
+static std::atomic<std::uint64_t> g_khz = kDefaultKhz;
+static std::atomic<std::uint32_t> g_timer_per_ms = 0;
+static bool g_invariant = false;
+// Set once the boot CPU has its call queue and takes interrupts.
+static std::atomic_bool g_boot_ready = false;
+
+static inline std::uint64_t scale(std::uint64_t x, std::uint64_t mult) noexcept
+{
+    return static_cast<std::uint64_t>((static_cast<unsigned __int128>(x) * mult) >> kShift);
+}
+
+// Preemption stays off so the TSC and the offset come from the same CPU.
+static inline std::uint64_t global_tsc() noexcept
+{
+    kern::sched::preempt_disable();
+    std::uint64_t tsc = kern::arch::rdtsc() + static_cast<std::uint64_t>(kern::percpu::this_cpu()->tsc_offset);
+    kern::sched::preempt_enable();
+    return tsc;
+}
+
+void init() noexcept
+{
+    std::uint64_t khz = hal::tsc::calibrate();
+    g_invariant = hal::tsc::invariant();
+    if (!khz)
+    {
+        hal::console::write("time: PIT calibration failed, assuming 3 GHz\n");
+        khz = kDefaultKhz;
+    }
+
+    std::uint64_t ns_mult = (1'000'000ull << kShift) / khz;
+    {
+        kern::sync::IrqSpinGuard<kern::sync::SeqLock> guard(g_clock_lock);
+        g_clock.tsc_base = global_tsc();
+        g_clock.ns_base = 0;
+        g_clock.mult = ns_mult;
+    }
+    g_ns_mult.store(ns_mult, std::memory_order_relaxed);
+    g_cyc_mult.store((khz << kShift) / 1'000'000, std::memory_order_relaxed);
+    g_khz.store(khz, std::memory_order_relaxed);
+    kern::trace::set_tsc_per_us(khz / 1000);
+
+    hal::console::write("time: tsc_khz=");
+    hal::console::write_hex<std::uint64_t>(khz);
+    hal::console::write(g_invariant ? " invariant\n" : " not invariant\n");
+}
+
+void calibrate_timer() noexcept
+{
+    std::uint32_t per_ms = hal::apic::timer_calibrate(kern::interrupts::kTimerDivide);
+    g_timer_per_ms.store(per_ms, std::memory_order_relaxed);
+    hal::console::write("time: lapic_timer_per_ms=");
+    hal::console::write_hex<std::uint32_t>(per_ms);
+    hal::console::write("\n");
+}
+
+void boot_cpu_ready() noexcept
+{
+    g_boot_ready.store(true, std::memory_order_release);
+}
+
+static void read_tsc(void *arg) noexcept
+{
+    *static_cast<std::uint64_t *>(arg) = kern::arch::rdtsc();
+}
+
+// The boot CPU reads its TSC in the middle of our round trip, give or take
+// half of it; the offset is taken from the shortest round trip.
+void sync_cpu() noexcept
+{
+    // Still on the AP's boot stack, before sched::run(), so spin.
+    while (!g_boot_ready.load(std::memory_order_acquire))
+        asm volatile("pause");
+
+    kern::sched::preempt_disable();
+    auto *self = kern::percpu::this_cpu();
+    if (self->index == 0)
+    {
+        kern::sched::preempt_enable();
+        return;
+    }
+
+    std::uint64_t best_rtt = ~std::uint64_t(0);
+    std::int64_t offset = 0;
+    for (int i = 0; i < kSyncRounds; ++i)
+    {
+        std::uint64_t remote = 0;
+        std::uint64_t t0 = kern::arch::rdtsc();
+        if (!kern::smp::call(kern::sched::CpuMask::only(0), read_tsc, &remote, true))
+            break;
+        std::uint64_t t1 = kern::arch::rdtsc();
+        if (remote == 0)
+            continue; // the boot CPU did not run it
+        if (t1 - t0 < best_rtt)
+        {
+            best_rtt = t1 - t0;
+            offset = static_cast<std::int64_t>(remote - (t0 + best_rtt / 2));
+        }
+    }
+    if (best_rtt == ~std::uint64_t(0))
+    {
+        hal::console::write("time: TSC sync with cpu 0 failed\n");
+        kern::sched::preempt_enable();
+        return;
+    }
+    // Within the measurement error the TSCs count as synchronized.
+    auto error = static_cast<std::int64_t>(best_rtt / 2);
+    if (offset > -error && offset < error)
+        offset = 0;
+    self->tsc_offset = offset;
+    kern::sched::preempt_enable();
+}
+
+std::uint64_t now_ns() noexcept
+{
+    Clock c;
+    std::uint64_t tsc;
+    std::uint32_t seq;
+    do
+    {
+        seq = g_clock_lock.read_begin();
+        c = g_clock;
+        tsc = global_tsc();
+    } while (g_clock_lock.read_retry(seq));
+    return c.ns_base + (tsc > c.tsc_base ? scale(tsc - c.tsc_base, c.mult) : 0);
+}
+
+std::uint64_t ns_to_cycles(std::uint64_t ns) noexcept
+{
+    return scale(ns, g_cyc_mult.load(std::memory_order_relaxed));
+}
+
+std::uint64_t cycles_to_ns(std::uint64_t cycles) noexcept
+{
+    return scale(cycles, g_ns_mult.load(std::memory_order_relaxed));
+}
+
+std::uint32_t timer_count(std::uint64_t ns) noexcept
+{
+    std::uint64_t count = g_timer_per_ms.load(std::memory_order_relaxed) * ns / 1'000'000;
+    return count > 0xFFFFFFFFu ? 0xFFFFFFFFu : static_cast<std::uint32_t>(count);
+}
+
+std::uint64_t tsc_khz() noexcept
+{
+    return g_khz.load(std::memory_order_relaxed);
+}
+
+bool tsc_invariant() noexcept
+{
+    return g_invariant;
+}
+
+} // namespace kern::time
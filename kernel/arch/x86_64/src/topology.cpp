@@ -0,0 +1,133 @@
+#include "kern/topology.hpp"
+#include "kern/arch/cpu.hpp"
+#include "kern/sched.hpp"
+
+namespace kern::topology
+{
+
+static CpuTopo g_topo[kern::sched::kMaxCpus] = {};
+
+static std::uint32_t bits_for(std::uint32_t count) noexcept
+{
+    std::uint32_t bits = 0;
+    while ((1u << bits) < count)
+        ++bits;
+    return bits;
+}
+
+// Walks leaf 0x1F or 0xB. Returns false if the leaf is unusable.
+static bool decode_extended(std::uint32_t leaf, std::uint32_t &x2apic_id, std::uint32_t &smt_shift,
+                            std::uint32_t &pkg_shift) noexcept
+{
+    bool have_smt = false;
+    bool have_any = false;
+    for (std::uint32_t sub = 0; sub < 8; ++sub)
+    {
+        auto r = kern::arch::cpuid(leaf, sub);
+        std::uint32_t type = (r.ecx >> 8) & 0xFF;
+        if (type == 0)
+            break;
+        std::uint32_t shift = r.eax & 0x1F;
+        x2apic_id = r.edx;
+        if (type == 1)
+        {
+            smt_shift = shift;
+            have_smt = true;
+        }
+        // The last valid level's shift covers everything below the package.
+        pkg_shift = shift;
+        have_any = true;
+    }
+    if (have_any && !have_smt)
+        smt_shift = 0;
+    return have_any;
+}
+
+// Leaf 4 (Intel deterministic cache parameters): width of the ID field
+// shared by the highest-level cache.
+static bool decode_llc_shift(std::uint32_t &llc_shift) noexcept
+{
+    std::uint32_t best_level = 0;
+    for (std::uint32_t sub = 0; sub < 16; ++sub)
+    {
+        auto r = kern::arch::cpuid(4, sub);
+        std::uint32_t type = r.eax & 0x1F;
+        if (type == 0)
+            break;
+        std::uint32_t level = (r.eax >> 5) & 0x7;
+        if (level >= best_level)
+        {
+            best_level = level;
+            llc_shift = bits_for(((r.eax >> 14) & 0xFFF) + 1);
+        }
+    }
+    return best_level != 0;
+}
+
+void detect_current(std::size_t cpu) noexcept
+{
+    if (cpu >= kern::sched::kMaxCpus)
+        return;
+
+    std::uint32_t max_leaf = kern::arch::cpuid(0).eax;
+    auto l1 = kern::arch::cpuid(1);
+    std::uint32_t apic_id = l1.ebx >> 24;
+    std::uint32_t smt_shift = 0;
+    std::uint32_t pkg_shift = 0;
+
+    bool ok = false;
+    if (max_leaf >= 0x1F)
+        ok = decode_extended(0x1F, apic_id, smt_shift, pkg_shift);
+    if (!ok && max_leaf >= 0xB)
+        ok = decode_extended(0xB, apic_id, smt_shift, pkg_shift);
+    if (!ok)
+    {
+        // Legacy: leaf 1 gives logical CPUs per package, leaf 4 cores per package.
+        std::uint32_t logical = (l1.edx & (1u << 28)) ? ((l1.ebx >> 16) & 0xFF) : 1;
+        std::uint32_t cores = 1;
+        if (max_leaf >= 4)
+            cores = ((kern::arch::cpuid(4, 0).eax >> 26) & 0x3F) + 1;
+        std::uint32_t threads = logical > cores ? logical / cores : 1;
+        smt_shift = bits_for(threads);
+        pkg_shift = bits_for(logical);
+    }
+
+    std::uint32_t llc_shift = pkg_shift;
+    if (max_leaf >= 4)
+        decode_llc_shift(llc_shift);
+
+    CpuTopo &t = g_topo[cpu];
+    t.apic_id = apic_id;
+    t.package = apic_id >> pkg_shift;
+    t.core = apic_id >> smt_shift;
+    t.smt = apic_id & ((1u << smt_shift) - 1);
+    t.llc = apic_id >> llc_shift;
+    t.valid = true;
+}
+
+const CpuTopo &get(std::size_t cpu) noexcept
+{
+    static const CpuTopo kNone{};
+    return cpu < kern::sched::kMaxCpus ? g_topo[cpu] : kNone;
+}
+
+// CPUs with no topology yet count as separate cores sharing nothing.
+bool same_core(std::size_t a, std::size_t b) noexcept
+{
+    if (a == b)
+        return true;
+    const CpuTopo &x = get(a);
+    const CpuTopo &y = get(b);
+    return x.valid && y.valid && x.core == y.core;
+}
+
+bool same_llc(std::size_t a, std::size_t b) noexcept
+{
+    if (a == b)
+        return true;
+    const CpuTopo &x = get(a);
+    const CpuTopo &y = get(b);
+    return x.valid && y.valid && x.llc == y.llc;
+}
+
+} // namespace kern::topology
@@ -0,0 +1,249 @@
+#include "kern/trace.hpp"
+#include "kern/arch/cpu.hpp"
+#include "kern/arch/percpu.hpp"
+#include "kern/interrupts.hpp"
+#include "kern/mem/heap.hpp"
+#include "kern/sched.hpp"
+#include "kern/sync/spinlock.hpp"
+#include <atomic>
+#include <cstdint>
+#include <new>
+
+namespace kern::trace
+{
+
+// Written only by the owning CPU with interrupts off, so no atomic RMW is
+// needed; `head` is published after the record it covers is complete.
+struct Ring
+{
+    std::atomic<std::uint64_t> head{0};
+    std::uint64_t drained{0}; // drain() only, under g_drain_lock
+    Record records[kRingRecords];
+};
+
+static std::atomic<std::uint64_t> g_tsc_per_us = 1000;
+
+void set_tsc_per_us(std::uint64_t cycles) noexcept
+{
+    if (cycles)
+        g_tsc_per_us.store(cycles, std::memory_order_relaxed);
+}
+
+#ifdef KERN_SCHED_TRACE
+
+static std::atomic<std::uint64_t> g_tsc_base = 0;
+static kern::sync::TicketLock g_drain_lock{"trace_drain"};
+
+void init_cpu() noexcept
+{
+    auto *b = kern::percpu::this_cpu();
+    if (b->trace_ring)
+        return;
+    void *mem = kern::mem::heap::kmalloc(sizeof(Ring), alignof(Ring));
+    if (!mem)
+        return;
+    std::uint64_t expected = 0;
+    g_tsc_base.compare_exchange_strong(expected, kern::arch::rdtsc(), std::memory_order_relaxed);
+    b->trace_ring = new (mem) Ring;
+}
+
+void emit(Event e, std::uint32_t a, std::uint32_t b, std::uint32_t c) noexcept
+{
+    auto flags = kern::interrupts::save();
+    kern::interrupts::disable();
+
+    Ring *r = kern::percpu::this_cpu()->trace_ring;
+    if (r)
+    {
+        std::uint64_t n = r->head.load(std::memory_order_relaxed);
+        Record &rec = r->records[n % kRingRecords];
+        // Invalidate first so a concurrent drain never accepts a half-written slot.
+        rec.seq.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        rec.tsc = kern::arch::rdtsc();
+        rec.a = a;
+        rec.b = b;
+        rec.c = c;
+        rec.event = e;
+        rec.seq.store(n + 1, std::memory_order_release);
+        r->head.store(n + 1, std::memory_order_release);
+    }
+
+    kern::interrupts::restore(flags);
+}
+
+static inline void outb(std::uint16_t port, std::uint8_t v) noexcept
+{
+    asm volatile("outb %0, %1" ::"a"(v), "Nd"(port));
+}
+
+static void put(const char *s) noexcept
+{
+    while (*s)
+        outb(0xE9, static_cast<std::uint8_t>(*s++));
+}
+
+static void put_dec(std::uint64_t v) noexcept
+{
+    char buf[21];
+    int i = 20;
+    buf[i] = '\0';
+    do
+    {
+        buf[--i] = static_cast<char>('0' + v % 10);
+        v /= 10;
+    } while (v);
+    put(buf + i);
+}
+
+// Chrome trace timestamps are microseconds; keep three decimals.
+static void put_ts(std::uint64_t tsc) noexcept
+{
+    std::uint64_t base = g_tsc_base.load(std::memory_order_relaxed);
+    std::uint64_t per_us = g_tsc_per_us.load(std::memory_order_relaxed);
+    std::uint64_t t = tsc > base ? tsc - base : 0;
+    std::uint64_t frac = (t % per_us) * 1000 / per_us;
+    put_dec(t / per_us);
+    put(".");
+    if (frac < 100)
+        put("0");
+    if (frac < 10)
+        put("0");
+    put_dec(frac);
+}
+
+static bool g_first = true;
+
+static void begin(const char *ph, std::size_t cpu, std::uint64_t tsc) noexcept
+{
+    put(g_first ? "\n{" : ",\n{");
+    g_first = false;
+    put("\"ph\":\"");
+    put(ph);
+    put("\",\"pid\":0,\"tid\":");
+    put_dec(cpu);
+    put(",\"ts\":");
+    put_ts(tsc);
+}
+
+static void put_thread_name(const char *prefix, std::uint32_t id) noexcept
+{
+    put(",\"name\":\"");
+    put(prefix);
+    put("T");
+    put_dec(id);
+    put("\"");
+}
+
+static void put_record(std::size_t cpu, const Record &r) noexcept
+{
+    switch (r.event)
+    {
+    case Event::Switch:
+    case Event::Preempt:
+        // Thread id 0 is the CPU's idle context; leave those gaps empty.
+        if (r.a)
+        {
+            begin("E", cpu, r.tsc);
+            put("}");
+        }
+        if (r.b)
+        {
+            begin("B", cpu, r.tsc);
+            put_thread_name("", r.b);
+            put(r.event == Event::Preempt ? ",\"args\":{\"preempted\":1}}" : ",\"args\":{\"preempted\":0}}");
+        }
+        begin("C", cpu, r.tsc);
+        put(",\"name\":\"runq");
+        put_dec(cpu);
+        put("\",\"args\":{\"len\":");
+        put_dec(r.c);
+        put("}}");
+        break;
+    case Event::Create:
+        begin("i", cpu, r.tsc);
+        put_thread_name("create ", r.a);
+        put(",\"s\":\"t\",\"args\":{\"cpu\":");
+        put_dec(r.b);
+        put("}}");
+        break;
+    case Event::Exit:
+        begin("i", cpu, r.tsc);
+        put_thread_name("exit ", r.a);
+        put(",\"s\":\"t\"}");
+        break;
+    case Event::Migrate:
+        begin("i", cpu, r.tsc);
+        put_thread_name("migrate ", r.a);
+        put(",\"s\":\"t\",\"args\":{\"to\":");
+        put_dec(r.b);
+        put("}}");
+        break;
+    case Event::Wakeup:
+        begin("i", cpu, r.tsc);
+        put_thread_name("wake ", r.a);
+        put(",\"s\":\"t\",\"args\":{\"cpu\":");
+        put_dec(r.b);
+        put("}}");
+        break;
+    }
+}
+
+void drain() noexcept
+{
+    kern::sync::SpinGuard<kern::sync::TicketLock> guard(g_drain_lock);
+
+    g_first = true;
+    put("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    std::size_t ncpu = kern::sched::cpu_count();
+    for (std::size_t cpu = 0; cpu < ncpu; ++cpu)
+    {
+        auto *b = kern::percpu::get(cpu);
+        Ring *r = b ? b->trace_ring : nullptr;
+        if (!r)
+            continue;
+
+        begin("M", cpu, 0);
+        put(",\"name\":\"thread_name\",\"args\":{\"name\":\"cpu ");
+        put_dec(cpu);
+        put("\"}}");
+
+        std::uint64_t head = r->head.load(std::memory_order_acquire);
+        std::uint64_t n = r->drained;
+        if (head - n > kRingRecords)
+            n = head - kRingRecords;
+        for (; n < head; ++n)
+        {
+            const Record &slot = r->records[n % kRingRecords];
+            if (slot.seq.load(std::memory_order_acquire) != n + 1)
+                continue;
+            Record copy;
+            copy.tsc = slot.tsc;
+            copy.a = slot.a;
+            copy.b = slot.b;
+            copy.c = slot.c;
+            copy.event = slot.event;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            // Overwritten by the producer while we copied it.
+            if (slot.seq.load(std::memory_order_relaxed) != n + 1)
+                continue;
+            put_record(cpu, copy);
+        }
+        r->drained = head;
+    }
+    put("\n]}\n");
+}
+
+#else
+
+void init_cpu() noexcept
+{
+}
+
+void drain() noexcept
+{
+}
+
+#endif
+
+} // namespace kern::trace
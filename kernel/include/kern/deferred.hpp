@@ -0,0 +1,44 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+namespace kern::deferred
+{
+
+// Deferred work (bottom halves). Interrupt handlers queue the expensive part
+// of their job here and return; it runs on the same CPU once the handler is
+// done, with interrupts enabled: first at interrupt exit, within a small
+// budget, then whatever is left in the CPU's deferred-work thread, which is
+// scheduled like any other thread.
+using WorkFn = void (*)(void *arg) noexcept;
+
+// Per-CPU queue capacity in items.
+constexpr std::size_t kQueueSize = 256;
+
+// Queues fn(arg) on the calling CPU. Safe from interrupt handlers. Returns
+// false if the queue is full or not set up yet.
+bool queue(WorkFn fn, void *arg) noexcept;
+
+// Allocates the calling CPU's queue and starts its thread. Called from
+// sched::init_cpu().
+void init_cpu() noexcept;
+
+// Runs queued work within the interrupt-exit budget. Called by the interrupt
+// code with interrupts off, only for interrupts that arrived with IF set;
+// returns with them off. Does nothing if the interrupted code had preemption
+// disabled, since it may hold a SpinGuard lock an item wants.
+void irq_tail() noexcept;
+
+struct Stats
+{
+    std::uint64_t queued{0};
+    std::uint64_t dropped{0};     // queue full
+    std::uint64_t run_irq{0};     // items run at interrupt exit
+    std::uint64_t run_thread{0};  // items run by the deferred-work thread
+    std::uint64_t over_budget{0}; // interrupt exits that left work behind
+};
+
+Stats stats(std::size_t cpu) noexcept;
+void dump_stats() noexcept;
+
+} // namespace kern::deferred
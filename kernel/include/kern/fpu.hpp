@@ -0,0 +1,47 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+namespace kern::sched
+{
+struct Thread;
+} // namespace kern::sched
+
+namespace kern::fpu
+{
+
+// Per-CPU setup: enables SSE, XSAVE and AVX when present, then sets CR0.TS
+// so the first SIMD instruction traps (#NM) and loads the thread's state.
+void init_cpu() noexcept;
+
+bool has_xsave() noexcept;
+bool has_avx() noexcept;
+
+// Save areas for threads created with kern::sched::kThreadSimd.
+void *alloc_state() noexcept;
+void free_state(void *state) noexcept;
+
+// Scheduler hook, called with interrupts off right before every switch.
+void switch_threads(kern::sched::Thread *prev, kern::sched::Thread *next) noexcept;
+
+// Borrows the SIMD registers for a short stretch of code, from a thread or
+// an interrupt handler. Live registers of a kThreadSimd thread are saved
+// first and reloaded by #NM. Interrupts stay off inside the region.
+class Region
+{
+public:
+    Region() noexcept;
+    ~Region() noexcept;
+    Region(const Region &) = delete;
+    Region &operator=(const Region &) = delete;
+
+private:
+    std::uint64_t flags_;
+};
+
+} // namespace kern::fpu
+
+// The kernel is built with -mno-sse; functions that may use SIMD carry one of
+// these and run only inside a fpu::Region or a kThreadSimd thread.
+#define KERN_SIMD_SSE __attribute__((target("sse2")))
+#define KERN_SIMD_AVX2 __attribute__((target("avx2")))
@@ -8,7 +8,12 @@ struct Frame;
 using Handler = void (*)(Frame *) noexcept;
 
 void init() noexcept;
+// Handlers run with interrupts off and must send their own EOI. Anything
+// slow belongs in kern::deferred::queue().
 void register_handler(std::uint8_t vector, Handler handler) noexcept;
+// Clears the vector and waits until no CPU still runs the old handler, so
+// its data may be freed afterwards. Not from interrupt handlers.
+void unregister_handler(std::uint8_t vector) noexcept;
 
 void enable() noexcept;
 void disable() noexcept;
@@ -0,0 +1,42 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include "kern/interrupts.hpp"
+#include "kern/sched.hpp"
+
+namespace kern::irq
+{
+
+// Device interrupts through the I/O APIC. request_*() allocate a vector,
+// install the handler (which, like any handler, runs with interrupts off
+// and sends its own EOI) and route the input to one CPU. Unless a CPU was
+// asked for, the balancer later moves busy inputs so that no core takes
+// more than its share of the interrupt load.
+
+// ISA IRQ `irq`, after the MADT overrides. `cpu` of kNoCpu picks the CPU
+// with the fewest inputs; any other value pins the input there. Returns the
+// vector, or 0 on failure.
+std::uint8_t request_isa(std::uint8_t irq, kern::interrupts::Handler handler,
+                         std::size_t cpu = kern::sched::kNoCpu) noexcept;
+std::uint8_t request_gsi(std::uint32_t gsi, bool level, bool active_low, kern::interrupts::Handler handler,
+                         std::size_t cpu = kern::sched::kNoCpu) noexcept;
+// Masks the input and frees the vector once no CPU runs the handler. Not
+// from interrupt handlers.
+void release(std::uint8_t vector) noexcept;
+// Moves the input to `cpu` and pins it there.
+bool set_affinity(std::uint8_t vector, std::size_t cpu) noexcept;
+
+// Raw vector allocation, for interrupts programmed elsewhere. 0 if none left.
+std::uint8_t alloc_vector() noexcept;
+void free_vector(std::uint8_t vector) noexcept;
+
+// One balancing pass over the rates since the previous one.
+void balance() noexcept;
+// Starts a thread that runs balance() every kBalanceInterval.
+void start_balancer() noexcept;
+// Nanoseconds.
+constexpr std::uint64_t kBalanceInterval = 300'000'000;
+
+void dump() noexcept;
+
+} // namespace kern::irq
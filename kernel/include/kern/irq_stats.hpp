@@ -0,0 +1,72 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include "kern/arch/cpu.hpp"
+
+namespace kern::irqstat
+{
+
+// Per-CPU interrupt statistics: per-vector counts and log2 histograms of
+// handler time, and timer-tick jitter. Compiled in with the `irq_stats`
+// build option (KERN_IRQ_STATS); otherwise the hooks are empty inlines and
+// the queries return zeros.
+
+// Histogram bucket i counts durations in [2^(i+kHistShift), 2^(i+kHistShift+1))
+// TSC cycles; the first and last buckets are open-ended.
+constexpr std::size_t kHistBuckets = 16;
+constexpr unsigned kHistShift = 6;
+
+// Allocates the calling CPU's counters. Called from sched::init_cpu().
+void init_cpu() noexcept;
+
+#ifdef KERN_IRQ_STATS
+inline std::uint64_t start() noexcept
+{
+    return kern::arch::rdtsc();
+}
+
+// One interrupt on `vector` whose handling began at `start`.
+void record(std::uint8_t vector, std::uint64_t start) noexcept;
+// A timer tick that arrived at `now`.
+void timer_arrival(std::uint64_t now) noexcept;
+#else
+inline std::uint64_t start() noexcept
+{
+    return 0;
+}
+
+inline void record(std::uint8_t, std::uint64_t) noexcept
+{
+}
+
+inline void timer_arrival(std::uint64_t) noexcept
+{
+}
+#endif
+
+struct VectorStats
+{
+    std::uint64_t count{0};
+    std::uint64_t total_cycles{0};
+    std::uint64_t max_cycles{0};
+    std::uint32_t hist[kHistBuckets]{};
+};
+
+// Jitter is each tick interval's distance from the expected one: kTickNs in
+// TSC cycles once time::calibrate_timer() has measured the LAPIC timer, so
+// steady drift counts too. Uncalibrated, the timer runs at a fixed guess and
+// the expected interval is a running average of the observed ones.
+struct TimerJitter
+{
+    std::uint64_t ticks{0};
+    std::uint64_t period{0}; // cycles
+    std::uint64_t max{0};
+    std::uint32_t hist[kHistBuckets]{};
+};
+
+VectorStats vector_stats(std::size_t cpu, std::uint8_t vector) noexcept;
+TimerJitter timer_jitter(std::size_t cpu) noexcept;
+// Prints every vector that fired, per CPU, and the tick jitter.
+void dump() noexcept;
+
+} // namespace kern::irqstat
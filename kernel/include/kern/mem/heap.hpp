@@ -8,4 +8,6 @@ namespace kern::mem::heap
 void init(std::size_t initial_pages = 64) noexcept;
 void *kmalloc(std::size_t bytes, std::size_t align = 16) noexcept;
 void kfree(void *p) noexcept;
+// Bytes taken by live allocations, block headers and alignment included.
+std::size_t used_bytes() noexcept;
 } // namespace kern::mem::heap
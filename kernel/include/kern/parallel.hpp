@@ -0,0 +1,88 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include "kern/mem/heap.hpp"
+
+namespace kern::parallel
+{
+
+// Chunk body for run(): handles [begin, end). `slot` is unique among the
+// participants of one call and below slots(), for per-participant scratch.
+using RangeFn = void (*)(std::size_t begin, std::size_t end, std::size_t slot, void *ctx) noexcept;
+
+// Runs `fn` over [begin, end) in chunks of at most `grain` indices on a
+// persistent pool of one worker per CPU, and returns once every index is
+// done. The caller works through chunks too rather than sleeping. Calls from
+// inside a chunk, or while the pool cannot be started, run serially.
+void run(std::size_t begin, std::size_t end, std::size_t grain, RangeFn fn, void *ctx) noexcept;
+
+// Participants per call: one per worker plus the caller. Starts the pool.
+std::size_t slots() noexcept;
+
+// Caps the participants of later calls at `n` (the caller counts as one;
+// 0 lifts the cap). Slot numbering is unchanged. For scaling measurements.
+void set_concurrency(std::size_t n) noexcept;
+
+// Calls fn(i) for every i in [begin, end).
+template <typename F> void parallel_for(std::size_t begin, std::size_t end, std::size_t grain, F &&fn) noexcept
+{
+    using Fn = std::remove_reference_t<F>;
+    run(
+        begin, end, grain,
+        [](std::size_t b, std::size_t e, std::size_t, void *ctx) noexcept {
+            Fn &f = *static_cast<Fn *>(ctx);
+            for (std::size_t i = b; i < e; ++i)
+                f(i);
+        },
+        const_cast<void *>(static_cast<const void *>(&fn)));
+}
+
+// Folds map(i) over [begin, end) with `combine`, which must be associative
+// and commutative: partial results are combined in no particular order.
+template <typename T, typename Map, typename Combine>
+T parallel_reduce(std::size_t begin, std::size_t end, std::size_t grain, T identity, Map &&map,
+                  Combine &&combine) noexcept
+{
+    std::size_t n = slots();
+    auto *partial = static_cast<T *>(kern::mem::heap::kmalloc(sizeof(T) * n, alignof(T) < 16 ? 16 : alignof(T)));
+    if (!partial)
+    {
+        T acc = identity;
+        for (std::size_t i = begin; i < end; ++i)
+            acc = combine(acc, map(i));
+        return acc;
+    }
+    for (std::size_t i = 0; i < n; ++i)
+        new (&partial[i]) T(identity);
+
+    struct Ctx
+    {
+        std::remove_reference_t<Map> *map;
+        std::remove_reference_t<Combine> *combine;
+        T *partial;
+    } c{&map, &combine, partial};
+
+    run(
+        begin, end, grain,
+        [](std::size_t b, std::size_t e, std::size_t slot, void *ctx) noexcept {
+            Ctx &c = *static_cast<Ctx *>(ctx);
+            T acc = c.partial[slot];
+            for (std::size_t i = b; i < e; ++i)
+                acc = (*c.combine)(acc, (*c.map)(i));
+            c.partial[slot] = acc;
+        },
+        &c);
+
+    T result = identity;
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        result = combine(result, partial[i]);
+        partial[i].~T();
+    }
+    kern::mem::heap::kfree(partial);
+    return result;
+}
+
+} // namespace kern::parallel
@@ -0,0 +1,98 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include "kern/sched.hpp"
+
+namespace kern::rcu
+{
+
+// Read-copy-update for read-mostly linked data. Readers run with preemption
+// off and take nothing else: no atomics, no shared writes. Writers unlink an
+// object, then free it with call() (or after synchronize()) once every CPU
+// has passed a quiescent state, so no reader can still hold it.
+//
+// Quiescent states: a context switch, the idle loop, and a timer tick that
+// interrupts code with preemption on. Code with interrupts off is a read
+// section too, which covers interrupt handlers.
+
+struct Head;
+using Callback = void (*)(Head *head) noexcept;
+
+// Embed in the object to be freed; call() links it into a per-CPU list.
+struct Head
+{
+    Head *next;
+    Callback fn;
+    std::uint64_t seq; // grace period to wait for
+};
+
+inline void read_lock() noexcept
+{
+    kern::sched::preempt_disable();
+}
+
+inline void read_unlock() noexcept
+{
+    kern::sched::preempt_enable();
+}
+
+class ReadGuard
+{
+public:
+    ReadGuard() noexcept
+    {
+        read_lock();
+    }
+
+    ~ReadGuard()
+    {
+        read_unlock();
+    }
+
+    ReadGuard(const ReadGuard &) = delete;
+    ReadGuard &operator=(const ReadGuard &) = delete;
+};
+
+// Loads a pointer readers follow, ordered before loads through it.
+template <typename T> inline T *dereference(T *const &p) noexcept
+{
+    return __atomic_load_n(&p, __ATOMIC_ACQUIRE);
+}
+
+// Publishes `v` (fully initialized) to readers.
+template <typename T> inline void assign(T *&p, T *v) noexcept
+{
+    __atomic_store_n(&p, v, __ATOMIC_RELEASE);
+}
+
+// Runs fn(head) on this CPU, from deferred work, after a grace period.
+// Safe from interrupt handlers.
+//
+// fn runs with interrupts on, in one of two places. In the CPU's
+// deferred-work thread, preemption is on too. At an interrupt exit whose
+// interrupted code held no SpinGuard (see deferred::irq_tail()), preemption
+// is off. Either way it may take SpinGuard and IrqSpinGuard locks, kfree()
+// included, but must not sleep: no wait_on(), synchronize() or AsyncEvent
+// waits.
+void call(Head *head, Callback fn) noexcept;
+
+// Waits for a full grace period. Not from a read section or interrupt handler.
+void synchronize() noexcept;
+
+// Scheduler hooks. quiescent() ignores calls made with preemption held.
+void quiescent() noexcept;
+void tick() noexcept;
+// Sets up the calling CPU. Called from sched::init_cpu().
+void init_cpu() noexcept;
+
+struct Stats
+{
+    std::uint64_t grace_periods{0}; // completed, system-wide
+    std::uint64_t queued{0};        // callbacks queued on this CPU
+    std::uint64_t run{0};           // callbacks run on this CPU
+};
+
+Stats stats(std::size_t cpu) noexcept;
+void dump_stats() noexcept;
+
+} // namespace kern::rcu
@@ -10,13 +10,193 @@ using ThreadFn = void (*)() noexcept;
 
 struct Thread;
 
+constexpr std::size_t kMaxCpus = 256;
+constexpr std::size_t kNoCpu = ~std::size_t(0);
+
+// Fair-class weight of a normal thread. A thread with twice the weight gets
+// twice the CPU share of its competitors on the same run queue.
+constexpr std::uint32_t kDefaultWeight = 1024;
+constexpr std::uint32_t kMinWeight = 16;
+constexpr std::uint32_t kMaxWeight = 64 * 1024;
+
+// create() flags.
+constexpr std::uint32_t kThreadSimd = 1u << 0; // may use SSE/AVX; gets a lazy save area
+
+// Set of logical CPU indices. Logical indices are assigned in the order
+// register_cpu() discovers CPUs; only the first cpu_count() bits are meaningful.
+struct CpuMask
+{
+    std::uint64_t bits[kMaxCpus / 64]{};
+
+    static constexpr CpuMask all() noexcept
+    {
+        CpuMask m;
+        for (auto &w : m.bits)
+            w = ~std::uint64_t(0);
+        return m;
+    }
+
+    static constexpr CpuMask only(std::size_t cpu) noexcept
+    {
+        CpuMask m;
+        m.set(cpu);
+        return m;
+    }
+
+    constexpr void set(std::size_t cpu) noexcept
+    {
+        if (cpu < kMaxCpus)
+            bits[cpu / 64] |= std::uint64_t(1) << (cpu % 64);
+    }
+
+    constexpr void clear(std::size_t cpu) noexcept
+    {
+        if (cpu < kMaxCpus)
+            bits[cpu / 64] &= ~(std::uint64_t(1) << (cpu % 64));
+    }
+
+    constexpr bool test(std::size_t cpu) const noexcept
+    {
+        return cpu < kMaxCpus && ((bits[cpu / 64] >> (cpu % 64)) & 1u);
+    }
+};
+
 void init() noexcept;
 void init_cpu() noexcept;
 void apic_ready() noexcept;
 void register_cpu(std::uint32_t apic_id) noexcept;
-Thread *create(ThreadFn fn, std::size_t stack_size = 16 * 1024) noexcept;
+std::size_t cpu_count() noexcept;
+// Logical index of the CPU with this local APIC ID, or kNoCpu if unknown.
+// Not from a CPU still on the early per-CPU block.
+std::size_t cpu_for_apic(std::uint32_t apic_id) noexcept;
+std::size_t current_cpu() noexcept;
+
+Thread *create(ThreadFn fn, std::size_t stack_size = 16 * 1024, std::uint32_t flags = 0) noexcept;
+// Creates a thread bound to `cpu`; widen it later with set_affinity().
+Thread *create_on(std::size_t cpu, ThreadFn fn, std::size_t stack_size = 16 * 1024,
+                  std::uint32_t flags = 0) noexcept;
+Thread *current() noexcept;
+
+// Ignored by the round-robin policy.
+void set_weight(Thread *t, std::uint32_t weight) noexcept;
+// Restricts `t` to the online CPUs in `mask`. Fails if that leaves none.
+bool set_affinity(Thread *t, const CpuMask &mask) noexcept;
+// Moves `t` to `cpu`. A running thread is pulled off its CPU by an IPI.
+bool migrate(Thread *t, std::size_t cpu) noexcept;
+
+// Deadline (EDF) class: every `period` the thread gets `runtime`, and each
+// job should finish `deadline` after its period starts. All in nanoseconds.
+// Deadline threads always run before normal ones and are pinned to the CPU
+// that admitted them. Fails if no allowed CPU has enough bandwidth left.
+// runtime == 0 returns the thread to the normal class (it stays pinned).
+bool set_deadline(Thread *t, std::uint64_t runtime, std::uint64_t deadline, std::uint64_t period) noexcept;
+// Ends the calling deadline thread's current job and sleeps until its next
+// period. A plain yield() for normal threads.
+void wait_next_period() noexcept;
+
+struct DeadlineStats
+{
+    std::uint64_t jobs{0};
+    std::uint64_t misses{0}; // jobs finished late, or cut off by their budget
+};
+
+DeadlineStats deadline_stats(const Thread *t) noexcept;
+// Prints jobs and misses of every deadline thread to the console.
+void dump_deadline_stats() noexcept;
+
+// How an idle CPU waited when it was woken for new work. Every idle period
+// starts with a short polling window, then MWAIT on the CPU's wake line when
+// the CPU supports it, otherwise HLT.
+enum class IdleMode : std::uint8_t
+{
+    Poll,
+    Mwait,
+    Hlt,
+};
+
+constexpr std::size_t kIdleModes = 3;
+
+// Idle-to-run latency, in TSC cycles from a remote CPU queueing work to the
+// idle CPU leaving its wait, per IdleMode.
+struct IdleStats
+{
+    std::uint64_t wakeups[kIdleModes]{};
+    std::uint64_t total[kIdleModes]{};
+    std::uint64_t max[kIdleModes]{};
+};
+
+// Switches all CPUs between MWAIT and HLT idle. Fails if MWAIT is unusable.
+bool set_idle_mwait(bool enable) noexcept;
+IdleStats idle_stats(std::size_t cpu) noexcept;
+void dump_idle_stats() noexcept;
+
+// CPU-time accounting, in TSC cycles.
+struct ThreadTimes
+{
+    std::uint64_t run{0};         // on a CPU
+    std::uint64_t wait{0};        // runnable but queued
+    std::uint64_t voluntary{0};   // switches away through yield()/yield_to()
+    std::uint64_t involuntary{0}; // preempted by the timer or an IPI
+    std::size_t last_cpu{kNoCpu};
+};
+
+// Busy and idle split wall time by whether a thread or the idle loop was
+// current; both include the interrupt time also counted in `irq`.
+struct CpuTimes
+{
+    std::uint64_t busy{0};
+    std::uint64_t idle{0};
+    std::uint64_t irq{0};
+};
+
+ThreadTimes thread_times(const Thread *t) noexcept;
+CpuTimes cpu_times(std::size_t cpu) noexcept;
+// Prints per-CPU load and the threads with the most run time, top-style.
+void dump_top() noexcept;
+
+// Preemption control for the calling CPU. While the nesting count is held,
+// the timer and reschedule IPI only note that a switch is due and the
+// outermost preempt_enable() yields. Spinlocks taken with interrupts on use
+// these so their holders are not switched out. The count belongs to the
+// CPU, so yield() and blocking waits halt with a diagnostic if it is held.
+void preempt_disable() noexcept;
+void preempt_enable() noexcept;
+// Preemptions postponed on `cpu` because its count was held.
+std::uint64_t deferred_preemptions(std::size_t cpu) noexcept;
+
 void yield() noexcept;
-void yield_from_irq(kern::interrupts::Frame *frame) noexcept;
+// Directed yield: switches straight to `t`, which must be a normal-class thread
+// queued on the calling CPU, and lets it run out the rest of the caller's
+// slice. Returns false without yielding if that is not possible right now
+// (including when a deadline thread is waiting).
+bool yield_to(Thread *t) noexcept;
+// Preemption from the timer and reschedule interrupts, in two steps so the
+// entry code saves the full register frame only when a switch is likely:
+// irq_should_preempt() does the tick's accounting and says whether the
+// current thread should give up the CPU; preempt_from_irq(), given the
+// complete frame, switches away (or returns if the reason went away).
+bool irq_should_preempt() noexcept;
+void preempt_from_irq(kern::interrupts::Frame *frame) noexcept;
+
+// Futex-style waiting on a 32-bit word, the building block for blocking
+// locks and events. wait_on() sleeps only if *addr still equals `expected`,
+// checked atomically against wake() on the same address; `timeout` is in
+// nanoseconds, 0 for none. Spurious returns are possible, so callers
+// re-check their condition. Threads only, never from interrupt handlers.
+enum class WaitResult
+{
+    Woken,
+    Mismatch, // *addr != expected, did not sleep
+    TimedOut,
+};
+WaitResult wait_on(const std::uint32_t *addr, std::uint32_t expected, std::uint64_t timeout = 0) noexcept;
+// Wakes up to `n` threads waiting on `addr` and returns how many. Cheap when
+// nobody waits. Safe from interrupt handlers.
+constexpr std::size_t kWakeAll = ~std::size_t(0);
+std::size_t wake(const std::uint32_t *addr, std::size_t n) noexcept;
+// Interrupt-time accounting, called by the interrupt dispatcher.
+void irq_enter() noexcept;
+void irq_exit() noexcept;
 void run() noexcept;
 
 } // namespace kern::sched
@@ -2,8 +2,45 @@
 #pragma once
 #include <cstddef>
 #include <cstdint>
+#include "kern/sched.hpp"
 
 namespace kern::smp
 {
 extern "C" void ap_entry(std::uint32_t apic_id) noexcept;
+
+// Cross-CPU function calls. call() runs fn(arg) on every CPU in `mask`, in
+// interrupt context on the target (interrupts off), with the calling CPU
+// running its own share directly. Requests to one target queue up and are
+// served by a single IPI: a sender only sends one when it finds the
+// target's queue empty. A mask covering every other CPU goes out as one
+// all-but-self IPI.
+using CallFn = void (*)(void *arg) noexcept;
+
+// With `wait`, returns once fn has finished everywhere; without, once it is
+// queued. Each CPU has one request slot per target, so a caller may wait
+// for its previous request to that target to finish. Call with interrupts
+// on (a CPU waiting on us must be able to interrupt us). Returns false if
+// the call machinery is not set up yet on this CPU or on a CPU in `mask`;
+// fn still runs on the CPUs that have it.
+bool call(const kern::sched::CpuMask &mask, CallFn fn, void *arg, bool wait) noexcept;
+
+// Allocates the calling CPU's queue and request slots. Called from
+// sched::init_cpu().
+void init_cpu() noexcept;
+
+// Serves the calling CPU's queue. Called by the interrupt code for the call
+// vector, with interrupts off.
+void handle_call_ipi() noexcept;
+
+struct Stats
+{
+    std::uint64_t requests{0};  // requests this CPU queued for others
+    std::uint64_t ipis_sent{0}; // IPIs this CPU sent for them (a broadcast counts once)
+    std::uint64_t ipis{0};      // call IPIs this CPU took
+    std::uint64_t served{0};    // requests this CPU ran from its queue
+};
+
+Stats stats(std::size_t cpu) noexcept;
+void dump_stats() noexcept;
+
 } // namespace kern::smp
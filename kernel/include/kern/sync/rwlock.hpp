@@ -0,0 +1,165 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <new>
+#include "kern/arch/percpu.hpp"
+#include "kern/interrupts.hpp"
+#include "kern/mem/heap.hpp"
+#include "kern/sched.hpp"
+#include "kern/sync/spinlock.hpp"
+
+namespace kern::sync
+{
+
+// Reader-writer lock for read-mostly data. Each CPU counts its readers in a
+// cache line of its own, so a read acquisition writes only CPU-local memory
+// and otherwise just reads the writer flag, which every cache keeps shared
+// until a writer shows up. Writers are serialized by a ticket lock, raise
+// the flag and wait for every CPU's count to drain: slow, and meant to be.
+//
+// The per-CPU counters come from the heap on the first use with interrupts
+// enabled (so never from a handler), one per CPU online at that point; CPUs
+// that come later share them modulo that count. Until then, or if the
+// allocation fails, readers share one counter. Sharing costs cache traffic,
+// not correctness.
+//
+// Readers hold preemption off (SharedGuard) and release the counter they
+// took. Read sections do not nest, and a CPU must not read from an
+// interrupt handler while one of its threads writes. Not before
+// percpu::install(): the early block every AP starts on has no CPU index.
+class RwLock
+{
+public:
+    struct Node
+    {
+    };
+
+    struct alignas(64) Slot
+    {
+        std::atomic<std::uint32_t> readers{0};
+    };
+
+    constexpr explicit RwLock(const char *name = "rwlock") noexcept : writer_lock_(name)
+    {
+    }
+    RwLock(const RwLock &) = delete;
+    RwLock &operator=(const RwLock &) = delete;
+
+    // Preemption must be off. Returns the counter to hand to unlock_shared().
+    Slot &lock_shared() noexcept
+    {
+        Slot &s = slot(kern::percpu::this_cpu()->index);
+        for (;;)
+        {
+            // The count is published before the flag is read; a writer does
+            // the opposite, so one of the two always sees the other.
+            s.readers.fetch_add(1, std::memory_order_seq_cst);
+            if (!writer_.load(std::memory_order_seq_cst))
+                return s;
+            s.readers.fetch_sub(1, std::memory_order_release);
+            while (writer_.load(std::memory_order_relaxed))
+                cpu_relax();
+        }
+    }
+
+    void unlock_shared(Slot &s) noexcept
+    {
+        s.readers.fetch_sub(1, std::memory_order_release);
+    }
+
+    void lock() noexcept
+    {
+        if (!slots_.load(std::memory_order_acquire) && (kern::interrupts::save() & (1u << 9)))
+            allocate();
+        writer_lock_.lock();
+        writer_.store(true, std::memory_order_seq_cst);
+        while (shared_.readers.load(std::memory_order_acquire))
+            cpu_relax();
+        // Loaded after the flag: a reader that counted in the array had
+        // already seen it published.
+        Slot *slots = slots_.load(std::memory_order_seq_cst);
+        std::size_t n = nslots_.load(std::memory_order_relaxed);
+        for (std::size_t i = 0; slots && i < n; ++i)
+        {
+            while (slots[i].readers.load(std::memory_order_acquire))
+                cpu_relax();
+        }
+    }
+
+    void unlock() noexcept
+    {
+        writer_.store(false, std::memory_order_release);
+        writer_lock_.unlock();
+    }
+
+    void lock(Node &) noexcept
+    {
+        lock();
+    }
+
+    void unlock(Node &) noexcept
+    {
+        unlock();
+    }
+
+private:
+    Slot &slot(std::size_t cpu) noexcept
+    {
+        Slot *slots = slots_.load(std::memory_order_acquire);
+        if (!slots && (kern::interrupts::save() & (1u << 9)))
+            slots = allocate();
+        if (!slots)
+            return shared_;
+        return slots[cpu % nslots_.load(std::memory_order_relaxed)];
+    }
+
+    // One attempt per lock; the loser of a race frees its copy.
+    Slot *allocate() noexcept
+    {
+        if (tried_.exchange(true, std::memory_order_relaxed))
+            return slots_.load(std::memory_order_acquire);
+        std::size_t n = kern::sched::cpu_count();
+        void *mem = kern::mem::heap::kmalloc(sizeof(Slot) * n, alignof(Slot));
+        if (!mem)
+            return nullptr;
+        auto *slots = static_cast<Slot *>(mem);
+        for (std::size_t i = 0; i < n; ++i)
+            new (&slots[i]) Slot;
+        nslots_.store(n, std::memory_order_relaxed);
+        slots_.store(slots, std::memory_order_release);
+        return slots;
+    }
+
+    Slot shared_;
+    alignas(64) std::atomic_bool writer_{false};
+    std::atomic<Slot *> slots_{nullptr};
+    std::atomic<std::size_t> nslots_{0};
+    std::atomic_bool tried_{false};
+    TicketLock writer_lock_;
+};
+
+// Read side of an RwLock; SpinGuard<RwLock> is the write side.
+class SharedGuard
+{
+public:
+    explicit SharedGuard(RwLock &lock) noexcept : lock_(lock)
+    {
+        kern::sched::preempt_disable();
+        slot_ = &lock_.lock_shared();
+    }
+
+    ~SharedGuard()
+    {
+        lock_.unlock_shared(*slot_);
+        kern::sched::preempt_enable();
+    }
+
+    SharedGuard(const SharedGuard &) = delete;
+    SharedGuard &operator=(const SharedGuard &) = delete;
+
+private:
+    RwLock &lock_;
+    RwLock::Slot *slot_;
+};
+
+} // namespace kern::sync
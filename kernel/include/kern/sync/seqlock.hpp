@@ -0,0 +1,84 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include "kern/sync/spinlock.hpp"
+
+namespace kern::sync
+{
+
+// Sequence lock for small read-mostly records (clock parameters and the
+// like). Readers take nothing and write nothing: they note the sequence,
+// copy the record and retry if a writer got in meanwhile. Writers are
+// serialized by a ticket lock and keep the sequence odd while they update.
+//
+// Readers may only copy: never follow a pointer out of a record that may be
+// torn. A reader that can interrupt a writer on the same CPU would spin
+// forever, so if interrupt handlers read, writers hold IrqSpinGuard.
+class SeqLock
+{
+public:
+    using Node = TicketLock::Node;
+
+    constexpr explicit SeqLock(const char *name = "seqlock") noexcept : writer_(name)
+    {
+    }
+    SeqLock(const SeqLock &) = delete;
+    SeqLock &operator=(const SeqLock &) = delete;
+
+    std::uint32_t read_begin() const noexcept
+    {
+        std::uint32_t seq;
+        while ((seq = seq_.load(std::memory_order_acquire)) & 1)
+            cpu_relax();
+        return seq;
+    }
+
+    // True if the copy taken since read_begin() returned `seq` may be torn.
+    bool read_retry(std::uint32_t seq) const noexcept
+    {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return seq_.load(std::memory_order_relaxed) != seq;
+    }
+
+    // A consistent copy of `data`, which this lock protects.
+    template <typename T> T read(const T &data) const noexcept
+    {
+        T copy;
+        std::uint32_t seq;
+        do
+        {
+            seq = read_begin();
+            copy = data;
+        } while (read_retry(seq));
+        return copy;
+    }
+
+    void lock() noexcept
+    {
+        writer_.lock();
+        seq_.store(seq_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    void unlock() noexcept
+    {
+        seq_.store(seq_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        writer_.unlock();
+    }
+
+    void lock(Node &) noexcept
+    {
+        lock();
+    }
+
+    void unlock(Node &) noexcept
+    {
+        unlock();
+    }
+
+private:
+    std::atomic<std::uint32_t> seq_{0};
+    TicketLock writer_;
+};
+
+} // namespace kern::sync
@@ -0,0 +1,272 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include "kern/arch/cpu.hpp"
+#include "kern/interrupts.hpp"
+#include "kern/sched.hpp"
+
+namespace kern::sync
+{
+
+// Spinlocks. TicketLock hands the lock out in arrival order; McsLock does
+// too, but each waiter spins on its own node, so a contended lock costs one
+// cache-line transfer per handoff instead of one per waiter. Both take a
+// Node per acquisition (empty for TicketLock), which the guards below keep
+// on the stack.
+//
+// Built with the `lock_stats` option (KERN_LOCK_STATS), every lock counts
+// acquisitions, contended acquisitions and cycles spent spinning, and shows
+// up in dump_lock_stats() once it has been taken.
+
+#ifdef KERN_LOCK_STATS
+struct LockStats
+{
+    const char *name;
+    std::atomic<std::uint64_t> acquisitions{0};
+    std::atomic<std::uint64_t> contended{0};
+    std::atomic<std::uint64_t> spin_cycles{0};
+    std::atomic_bool listed{false};
+    LockStats *next{nullptr};
+};
+
+void register_stats(LockStats *s) noexcept;
+#endif
+
+// Prints every lock taken so far. Empty without KERN_LOCK_STATS.
+void dump_lock_stats() noexcept;
+
+inline void cpu_relax() noexcept
+{
+    asm volatile("pause" ::: "memory");
+}
+
+// Per-lock accounting. A member rather than a base so the locks stay
+// standard-layout (CpuBlock offsets are checked with offsetof).
+class LockAccounting
+{
+public:
+    constexpr explicit LockAccounting(const char *name) noexcept
+#ifdef KERN_LOCK_STATS
+        : stats_{name}
+#endif
+    {
+        (void)name;
+    }
+
+    static std::uint64_t spin_start() noexcept
+    {
+#ifdef KERN_LOCK_STATS
+        return kern::arch::rdtsc();
+#else
+        return 0;
+#endif
+    }
+
+    // `start` is the spin_start() of a contended acquisition.
+    void acquired(bool contended, std::uint64_t start = 0) noexcept
+    {
+#ifdef KERN_LOCK_STATS
+        if (!stats_.listed.load(std::memory_order_relaxed) && !stats_.listed.exchange(true))
+            register_stats(&stats_);
+        stats_.acquisitions.fetch_add(1, std::memory_order_relaxed);
+        if (contended)
+        {
+            stats_.contended.fetch_add(1, std::memory_order_relaxed);
+            stats_.spin_cycles.fetch_add(kern::arch::rdtsc() - start, std::memory_order_relaxed);
+        }
+#else
+        (void)contended;
+        (void)start;
+#endif
+    }
+
+private:
+#ifdef KERN_LOCK_STATS
+    LockStats stats_;
+#endif
+};
+
+class TicketLock
+{
+public:
+    struct Node
+    {
+    };
+
+    constexpr explicit TicketLock(const char *name = "ticket") noexcept : acct_(name)
+    {
+    }
+    TicketLock(const TicketLock &) = delete;
+    TicketLock &operator=(const TicketLock &) = delete;
+
+    void lock() noexcept
+    {
+        std::uint32_t me = next_.fetch_add(1, std::memory_order_relaxed);
+        if (owner_.load(std::memory_order_acquire) == me)
+        {
+            acct_.acquired(false);
+            return;
+        }
+        std::uint64_t start = LockAccounting::spin_start();
+        while (owner_.load(std::memory_order_acquire) != me)
+            cpu_relax();
+        acct_.acquired(true, start);
+    }
+
+    bool try_lock() noexcept
+    {
+        std::uint32_t owner = owner_.load(std::memory_order_relaxed);
+        std::uint32_t expected = owner;
+        if (!next_.compare_exchange_strong(expected, owner + 1, std::memory_order_acquire, std::memory_order_relaxed))
+            return false;
+        acct_.acquired(false);
+        return true;
+    }
+
+    void unlock() noexcept
+    {
+        owner_.store(owner_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    bool is_locked() const noexcept
+    {
+        return next_.load(std::memory_order_relaxed) != owner_.load(std::memory_order_relaxed);
+    }
+
+    void lock(Node &) noexcept
+    {
+        lock();
+    }
+
+    void unlock(Node &) noexcept
+    {
+        unlock();
+    }
+
+private:
+    std::atomic<std::uint32_t> next_{0};
+    std::atomic<std::uint32_t> owner_{0};
+    [[no_unique_address]] LockAccounting acct_;
+};
+
+class McsLock
+{
+public:
+    struct Node
+    {
+        std::atomic<Node *> next{nullptr};
+        std::atomic_bool locked{false};
+    };
+
+    constexpr explicit McsLock(const char *name = "mcs") noexcept : acct_(name)
+    {
+    }
+    McsLock(const McsLock &) = delete;
+    McsLock &operator=(const McsLock &) = delete;
+
+    void lock(Node &n) noexcept
+    {
+        n.next.store(nullptr, std::memory_order_relaxed);
+        n.locked.store(true, std::memory_order_relaxed);
+        Node *prev = tail_.exchange(&n, std::memory_order_acq_rel);
+        if (!prev)
+        {
+            acct_.acquired(false);
+            return;
+        }
+        std::uint64_t start = LockAccounting::spin_start();
+        prev->next.store(&n, std::memory_order_release);
+        while (n.locked.load(std::memory_order_acquire))
+            cpu_relax();
+        acct_.acquired(true, start);
+    }
+
+    bool try_lock(Node &n) noexcept
+    {
+        n.next.store(nullptr, std::memory_order_relaxed);
+        Node *expected = nullptr;
+        if (!tail_.compare_exchange_strong(expected, &n, std::memory_order_acquire, std::memory_order_relaxed))
+            return false;
+        acct_.acquired(false);
+        return true;
+    }
+
+    void unlock(Node &n) noexcept
+    {
+        Node *next = n.next.load(std::memory_order_acquire);
+        if (!next)
+        {
+            // No successor linked yet: either nobody waits, or one has
+            // swapped the tail and is about to link itself.
+            Node *expected = &n;
+            if (tail_.compare_exchange_strong(expected, nullptr, std::memory_order_release,
+                                              std::memory_order_relaxed))
+                return;
+            while (!(next = n.next.load(std::memory_order_acquire)))
+                cpu_relax();
+        }
+        next->locked.store(false, std::memory_order_release);
+    }
+
+    bool is_locked() const noexcept
+    {
+        return tail_.load(std::memory_order_relaxed) != nullptr;
+    }
+
+private:
+    std::atomic<Node *> tail_{nullptr};
+    [[no_unique_address]] LockAccounting acct_;
+};
+
+// Holds `lock` with preemption off, so no CPU spins on a holder that has
+// been switched out. For locks never taken from interrupt handlers.
+template <typename Lock> class SpinGuard
+{
+public:
+    explicit SpinGuard(Lock &lock) noexcept : lock_(lock)
+    {
+        kern::sched::preempt_disable();
+        lock_.lock(node_);
+    }
+
+    ~SpinGuard()
+    {
+        lock_.unlock(node_);
+        kern::sched::preempt_enable();
+    }
+
+    SpinGuard(const SpinGuard &) = delete;
+    SpinGuard &operator=(const SpinGuard &) = delete;
+
+private:
+    Lock &lock_;
+    typename Lock::Node node_{};
+};
+
+// Holds `lock` with interrupts off (restored afterwards). For locks that
+// interrupt handlers take too.
+template <typename Lock> class IrqSpinGuard
+{
+public:
+    explicit IrqSpinGuard(Lock &lock) noexcept : lock_(lock), flags_(kern::interrupts::save())
+    {
+        kern::interrupts::disable();
+        lock_.lock(node_);
+    }
+
+    ~IrqSpinGuard()
+    {
+        lock_.unlock(node_);
+        kern::interrupts::restore(flags_);
+    }
+
+    IrqSpinGuard(const IrqSpinGuard &) = delete;
+    IrqSpinGuard &operator=(const IrqSpinGuard &) = delete;
+
+private:
+    Lock &lock_;
+    std::uint64_t flags_;
+    typename Lock::Node node_{};
+};
+
+} // namespace kern::sync
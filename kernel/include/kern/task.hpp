@@ -0,0 +1,336 @@
+#pragma once
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
+#include "kern/mem/heap.hpp"
+#include "kern/sync/spinlock.hpp"
+
+namespace kern
+{
+
+// Stackless kernel tasks. A task<T> is a lazily started C++ coroutine: it
+// runs when awaited by another task or when handed to spawn(). Spawned tasks
+// run on a per-CPU executor thread and may suspend on task_yield(),
+// task_sleep() and AsyncEvent without holding a kernel stack.
+
+namespace exec
+{
+
+// Link for a suspended coroutine in an executor or wait queue. Lives in the
+// suspended coroutine's frame, so queueing never allocates.
+struct WaitNode
+{
+    WaitNode *next{nullptr};
+    std::coroutine_handle<> handle{};
+    std::uint64_t wake_tsc{0};
+    std::size_t cpu{0};
+};
+
+// Queues `n` on the executor of n->cpu and wakes that executor if needed.
+// Safe from interrupt handlers.
+void schedule(WaitNode *n) noexcept;
+// Parks `n` on the current executor until the TSC reaches n->wake_tsc.
+void sleep(WaitNode *n) noexcept;
+// CPU of the executor running the caller.
+std::size_t this_executor() noexcept;
+
+} // namespace exec
+
+template <typename T = void> class task;
+
+namespace detail
+{
+
+struct promise_base
+{
+    std::coroutine_handle<> continuation{};
+    bool detached{false};
+    exec::WaitNode node{}; // first resume of a spawned task
+
+    // Frames come from the kernel heap. operator new must not throw, so the
+    // compiler checks for nullptr and uses the allocation-failure hook below.
+    static void *operator new(std::size_t size) noexcept
+    {
+        return kern::mem::heap::kmalloc(size);
+    }
+
+    static void operator delete(void *p) noexcept
+    {
+        kern::mem::heap::kfree(p);
+    }
+
+    std::suspend_always initial_suspend() noexcept
+    {
+        return {};
+    }
+
+    struct final_awaiter
+    {
+        bool await_ready() noexcept
+        {
+            return false;
+        }
+
+        template <typename P> std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept
+        {
+            promise_base &p = h.promise();
+            if (p.continuation)
+                return p.continuation;
+            if (p.detached)
+                h.destroy();
+            return std::noop_coroutine();
+        }
+
+        void await_resume() noexcept
+        {
+        }
+    };
+
+    final_awaiter final_suspend() noexcept
+    {
+        return {};
+    }
+
+    // Built with -fno-exceptions: nothing can be thrown.
+    void unhandled_exception() noexcept
+    {
+        __builtin_trap();
+    }
+};
+
+template <typename T> struct promise final : promise_base
+{
+    alignas(T) unsigned char storage[sizeof(T)];
+    bool has_value{false};
+
+    promise() noexcept = default;
+    promise(const promise &) = delete;
+
+    ~promise()
+    {
+        if (has_value)
+            reinterpret_cast<T *>(storage)->~T();
+    }
+
+    task<T> get_return_object() noexcept;
+    static task<T> get_return_object_on_allocation_failure() noexcept;
+
+    template <typename U> void return_value(U &&v) noexcept
+    {
+        new (storage) T(std::forward<U>(v));
+        has_value = true;
+    }
+
+    T take() noexcept
+    {
+        return std::move(*reinterpret_cast<T *>(storage));
+    }
+};
+
+template <> struct promise<void> final : promise_base
+{
+    task<void> get_return_object() noexcept;
+    static task<void> get_return_object_on_allocation_failure() noexcept;
+
+    void return_void() noexcept
+    {
+    }
+
+    void take() noexcept
+    {
+    }
+};
+
+} // namespace detail
+
+template <typename T> class task
+{
+public:
+    using promise_type = detail::promise<T>;
+    using handle_type = std::coroutine_handle<promise_type>;
+
+    task() noexcept = default;
+    explicit task(handle_type h) noexcept : h_(h)
+    {
+    }
+    task(task &&o) noexcept : h_(std::exchange(o.h_, {}))
+    {
+    }
+    task &operator=(task &&o) noexcept
+    {
+        if (this != &o)
+        {
+            if (h_)
+                h_.destroy();
+            h_ = std::exchange(o.h_, {});
+        }
+        return *this;
+    }
+    task(const task &) = delete;
+    task &operator=(const task &) = delete;
+
+    ~task()
+    {
+        if (h_)
+            h_.destroy();
+    }
+
+    // False if the frame could not be allocated. Do not await such a task.
+    bool valid() const noexcept
+    {
+        return static_cast<bool>(h_);
+    }
+
+    // Gives up ownership; the frame then frees itself when it completes.
+    handle_type release() noexcept
+    {
+        return std::exchange(h_, {});
+    }
+
+    bool await_ready() const noexcept
+    {
+        return !h_ || h_.done();
+    }
+
+    // Symmetric transfer: the awaiting coroutine resumes when this one ends,
+    // without growing the executor's stack.
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+    {
+        h_.promise().continuation = awaiting;
+        return h_;
+    }
+
+    T await_resume() noexcept
+    {
+        return h_.promise().take();
+    }
+
+private:
+    handle_type h_{};
+};
+
+template <typename T> task<T> detail::promise<T>::get_return_object() noexcept
+{
+    return task<T>{std::coroutine_handle<promise<T>>::from_promise(*this)};
+}
+
+template <typename T> task<T> detail::promise<T>::get_return_object_on_allocation_failure() noexcept
+{
+    return task<T>{};
+}
+
+inline task<void> detail::promise<void>::get_return_object() noexcept
+{
+    return task<void>{std::coroutine_handle<promise<void>>::from_promise(*this)};
+}
+
+inline task<void> detail::promise<void>::get_return_object_on_allocation_failure() noexcept
+{
+    return task<void>{};
+}
+
+// Starts `t` detached on the executor of `cpu` (its thread is created on first
+// use). Returns false if `t` is invalid or the executor cannot be started.
+bool spawn_on(std::size_t cpu, task<void> t) noexcept;
+// spawn_on() for the calling CPU.
+bool spawn(task<void> t) noexcept;
+
+// Requeues the calling task behind the other ready tasks of its executor.
+struct task_yield
+{
+    exec::WaitNode node{};
+
+    bool await_ready() const noexcept
+    {
+        return false;
+    }
+
+    void await_suspend(std::coroutine_handle<> h) noexcept
+    {
+        node.handle = h;
+        node.cpu = exec::this_executor();
+        exec::schedule(&node);
+    }
+
+    void await_resume() noexcept
+    {
+    }
+};
+
+// Suspends the calling task for at least `ns` nanoseconds. Resolution is
+// the scheduler tick when the executor has nothing else to run.
+struct task_sleep
+{
+    explicit task_sleep(std::uint64_t ns) noexcept : ns(ns)
+    {
+    }
+
+    std::uint64_t ns;
+    exec::WaitNode node{};
+
+    bool await_ready() const noexcept
+    {
+        return ns == 0;
+    }
+
+    void await_suspend(std::coroutine_handle<> h) noexcept;
+
+    void await_resume() noexcept
+    {
+    }
+};
+
+// Manual-reset event for tasks. set() releases every waiter, each on the
+// executor it suspended on; waiting on a set event does not suspend. set()
+// may be called from interrupt handlers and ordinary threads.
+class AsyncEvent
+{
+public:
+    struct awaiter
+    {
+        AsyncEvent &ev;
+        exec::WaitNode node{};
+
+        bool await_ready() const noexcept
+        {
+            return ev.is_set();
+        }
+
+        bool await_suspend(std::coroutine_handle<> h) noexcept
+        {
+            node.handle = h;
+            node.cpu = exec::this_executor();
+            return ev.enqueue(&node);
+        }
+
+        void await_resume() noexcept
+        {
+        }
+    };
+
+    awaiter wait() noexcept
+    {
+        return awaiter{*this};
+    }
+
+    bool is_set() const noexcept
+    {
+        return set_.load(std::memory_order_acquire);
+    }
+
+    void set() noexcept;
+    void reset() noexcept;
+
+private:
+    // False if the event was set meanwhile, so the caller resumes at once.
+    bool enqueue(exec::WaitNode *n) noexcept;
+
+    std::atomic_bool set_{false};
+    kern::sync::TicketLock lock_{"event"};
+    exec::WaitNode *waiters_{nullptr};
+};
+
+} // namespace kern
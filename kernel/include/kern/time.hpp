@@ -0,0 +1,39 @@
+#pragma once
+#include <cstdint>
+
+namespace kern::time
+{
+
+// Monotonic kernel clock in nanoseconds since init(). It scales the TSC by
+// the rate measured against the PIT at boot; each CPU adds an offset onto
+// the boot CPU's TSC, so readings agree across CPUs whose TSCs were not
+// started together. Readers are lock-free (a seqlock over the clock
+// parameters). Until init() runs the TSC is assumed to tick at 3 GHz.
+
+// Calibrates the TSC and starts the clock. Boot CPU, before the APs start:
+// their bring-up delays use the measured rate.
+void init() noexcept;
+// Measures the local APIC timer rate. Boot CPU, once its local APIC is
+// enabled; timer_count() returns 0 before.
+void calibrate_timer() noexcept;
+// Measures the calling AP's TSC offset against the boot CPU with a cross-CPU
+// call. APs only, with interrupts on; waits for boot_cpu_ready() first.
+void sync_cpu() noexcept;
+// Called by the boot CPU once it has enabled interrupts, so that it can
+// answer sync_cpu().
+void boot_cpu_ready() noexcept;
+
+std::uint64_t now_ns() noexcept;
+
+// Durations (the scheduler accounts in TSC cycles).
+std::uint64_t ns_to_cycles(std::uint64_t ns) noexcept;
+std::uint64_t cycles_to_ns(std::uint64_t cycles) noexcept;
+
+// Initial count for a local APIC timer period of `ns` at
+// kern::interrupts::kTimerDivide, 0 if the timer was not calibrated.
+std::uint32_t timer_count(std::uint64_t ns) noexcept;
+
+std::uint64_t tsc_khz() noexcept;
+bool tsc_invariant() noexcept;
+
+} // namespace kern::time
@@ -0,0 +1,27 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+namespace kern::topology
+{
+
+// Position of one logical CPU, decoded from its x2APIC ID. IDs are only
+// comparable between CPUs, not meaningful on their own.
+struct CpuTopo
+{
+    std::uint32_t apic_id{0};
+    std::uint32_t package{0};
+    std::uint32_t core{0}; // unique across packages
+    std::uint32_t smt{0};  // thread index within the core
+    std::uint32_t llc{0};  // CPUs with the same value share the last-level cache
+    bool valid{false};
+};
+
+// Fills the table entry for logical CPU `cpu`. Must run on that CPU.
+void detect_current(std::size_t cpu) noexcept;
+
+const CpuTopo &get(std::size_t cpu) noexcept;
+bool same_core(std::size_t a, std::size_t b) noexcept;
+bool same_llc(std::size_t a, std::size_t b) noexcept;
+
+} // namespace kern::topology
@@ -0,0 +1,57 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace kern::trace
+{
+
+// Scheduler tracepoints. Compiled in with the `sched_trace` build option
+// (KERN_SCHED_TRACE); otherwise emit() is an empty inline and drain() a no-op.
+enum class Event : std::uint8_t
+{
+    Switch,  // a = prev thread id, b = next thread id, c = run-queue length
+    Preempt, // as Switch, from the timer or a reschedule IPI
+    Create,  // a = thread id, b = target CPU
+    Exit,    // a = thread id
+    Migrate, // a = thread id, b = destination CPU
+    Wakeup,  // a = thread id, b = CPU it was queued on
+};
+
+// One fixed-size ring slot. `seq` is written last: a reader accepts the slot
+// only if it still holds the sequence number it expects.
+struct Record
+{
+    std::uint64_t tsc;
+    std::atomic<std::uint64_t> seq;
+    std::uint32_t a;
+    std::uint32_t b;
+    std::uint32_t c;
+    Event event;
+};
+
+static_assert(sizeof(Record) == 32);
+
+// Per-CPU ring size in records; the oldest entries are overwritten.
+constexpr std::size_t kRingRecords = 512;
+
+// Allocates the calling CPU's ring. Called from sched::init_cpu().
+void init_cpu() noexcept;
+
+#ifdef KERN_SCHED_TRACE
+void emit(Event e, std::uint32_t a = 0, std::uint32_t b = 0, std::uint32_t c = 0) noexcept;
+#else
+inline void emit(Event, std::uint32_t = 0, std::uint32_t = 0, std::uint32_t = 0) noexcept
+{
+}
+#endif
+
+// Streams everything recorded since the previous drain to the 0xE9 debugcon
+// as one Chrome trace JSON object (load it in chrome://tracing or Perfetto).
+void drain() noexcept;
+
+// Timestamps are exported as TSC / cycles-per-microsecond. Until the TSC is
+// calibrated this assumes 1 GHz.
+void set_tsc_per_us(std::uint64_t cycles) noexcept;
+
+} // namespace kern::trace
@@ -1,7 +1,7 @@
 // heap.cpp
 #include "kern/mem/heap.hpp"
 #include "kern/mem/pmm.hpp"
-#include <atomic>
+#include "kern/sync/spinlock.hpp"
 #include <cstddef>
 #include <cstdint>
 #include <limits>
@@ -21,18 +21,11 @@ struct Block
 static std::uintptr_t g_heap_base = 0;
 static std::uintptr_t g_heap_end = 0;
 static Block *g_head = nullptr;
-static std::atomic_flag g_lock = ATOMIC_FLAG_INIT;
-
-static inline void lock() noexcept
-{
-    while (g_lock.test_and_set(std::memory_order_acquire))
-        asm volatile("pause");
-}
-
-static inline void unlock() noexcept
-{
-    g_lock.clear(std::memory_order_release);
-}
+static std::size_t g_used = 0; // under g_lock
+// Every CPU allocates through here, so waiters queue on their own nodes.
+// Taken with preemption off (SpinGuard), never from interrupt handlers.
+static kern::sync::McsLock g_lock{"heap"};
+using Guard = kern::sync::SpinGuard<kern::sync::McsLock>;
 
 static inline bool align_up_checked(std::uintptr_t v, std::size_t align, std::uintptr_t &out) noexcept
 {
@@ -67,7 +60,6 @@ void init(std::size_t initial_pages) noexcept
     g_heap_base = 0;
     g_heap_end = 0;
     g_head = nullptr;
-    g_lock.clear(std::memory_order_release);
 
     // Reserve N pages physically, identity-mapped, used as heap.
     std::uintptr_t first = 0;
@@ -131,7 +123,7 @@ void *kmalloc(std::size_t bytes, std::size_t align) noexcept
         align = a;
     }
 
-    lock();
+    Guard guard(g_lock);
 
     for (Block *b = g_head; b; b = b->next)
     {
@@ -172,12 +164,11 @@ void *kmalloc(std::size_t bytes, std::size_t align) noexcept
         }
 
         b->free = false;
+        g_used += sizeof(Block) + b->size;
         *reinterpret_cast<std::uintptr_t *>(payload - sizeof(std::uintptr_t)) = reinterpret_cast<std::uintptr_t>(b);
-        unlock();
         return reinterpret_cast<void *>(payload);
     }
 
-    unlock();
     return nullptr;
 }
 
@@ -214,13 +205,10 @@ void kfree(void *p) noexcept
     if (up < g_heap_base || up >= g_heap_end)
         return;
 
-    lock();
+    Guard guard(g_lock);
 
     if (up < g_heap_base + sizeof(Block) + sizeof(std::uintptr_t))
-    {
-        unlock();
         return;
-    }
 
     auto meta = up - sizeof(std::uintptr_t);
     auto *b = reinterpret_cast<Block *>(*reinterpret_cast<std::uintptr_t *>(meta));
@@ -228,37 +216,26 @@ void kfree(void *p) noexcept
     {
         auto baddr = reinterpret_cast<std::uintptr_t>(b);
         if (baddr < g_heap_base || baddr + sizeof(Block) > g_heap_end)
-        {
-            unlock();
             return;
-        }
         auto base = block_base(b);
         if (base > up || base < g_heap_base)
-        {
-            unlock();
             return;
-        }
         if (b->size > g_heap_end - base)
-        {
-            unlock();
             return;
-        }
         auto end = base + b->size;
         if (meta < base || meta + sizeof(std::uintptr_t) > end)
-        {
-            unlock();
             return;
-        }
         if (b->free)
-        {
-            unlock();
             return;
-        }
         b->free = true;
+        g_used -= sizeof(Block) + b->size;
         coalesce(b);
     }
+}
 
-    unlock();
+std::size_t used_bytes() noexcept
+{
+    return __atomic_load_n(&g_used, __ATOMIC_RELAXED);
 }
 
 } // namespace kern::mem::heap
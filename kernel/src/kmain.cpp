@@ -1,13 +1,36 @@
 #include "hal/apic.hpp"
 #include "hal/console.hpp"
+#include "kern/arch/cpu.hpp"
+#include "kern/arch/interrupts.hpp"
+#include "kern/deferred.hpp"
+#include "kern/fpu.hpp"
 #include "kern/interrupts.hpp"
+#include "kern/irq.hpp"
 #include "kern/mem/heap.hpp"
 #include "kern/mem/pmm.hpp"
+#include "kern/parallel.hpp"
 #include "kern/sched.hpp"
 #include "kern/smp.hpp"
+#include "kern/task.hpp"
+#include "kern/time.hpp"
+#include "kern/trace.hpp"
 #include "hal/smp.hpp"
+#include <atomic>
 #include <cstdint>
 
+static void spin_ns(std::uint64_t ns) noexcept
+{
+    std::uint64_t end = kern::time::now_ns() + ns;
+    while (kern::time::now_ns() < end)
+        asm volatile("pause");
+}
+
+static inline void outb(std::uint16_t port, std::uint8_t v) noexcept
+{
+    asm volatile("outb %0, %1" ::"a"(v), "Nd"(port));
+}
+
+#ifndef KERN_SCHED_BENCH
 static void worker1() noexcept
 {
     hal::console::write("[T1] cpu=");
@@ -33,6 +56,497 @@ static void worker_heap() noexcept
     kern::sched::yield();
 }
 
+// Deadline smoke test: a periodic job (25% of a CPU) next to fair CPU hogs.
+// Reports how many of its jobs missed their deadline.
+static void worker_deadline() noexcept
+{
+    auto *self = kern::sched::current();
+    if (!kern::sched::set_deadline(self, 350'000, 1'000'000, 1'300'000))
+    {
+        hal::console::write("[DL] admission refused\n");
+        return;
+    }
+    for (int i = 0; i < 200; ++i)
+    {
+        spin_ns(200'000);
+        kern::sched::wait_next_period();
+    }
+    auto stats = kern::sched::deadline_stats(self);
+    hal::console::write("[DL] jobs=");
+    hal::console::write_hex<std::uint64_t>(stats.jobs);
+    hal::console::write(" missed=");
+    hal::console::write_hex<std::uint64_t>(stats.misses);
+    hal::console::write("\n");
+}
+static void worker_hog() noexcept
+{
+    spin_ns(130'000'000);
+}
+
+// Pool smoke test: sum of 0..65535 spread over every CPU.
+static void worker_parallel() noexcept
+{
+    std::uint64_t sum = kern::parallel::parallel_reduce(
+        0, 65536, 1024, std::uint64_t(0), [](std::size_t i) noexcept { return std::uint64_t(i); },
+        [](std::uint64_t a, std::uint64_t b) noexcept { return a + b; });
+    hal::console::write(sum == 65536ull * 65535 / 2 ? "[PF] reduce ok\n" : "[PF] reduce MISMATCH\n");
+}
+
+// Deferred-work smoke test: items queued from a thread run at the next
+// interrupt exit or in the CPU's deferred-work thread.
+static std::atomic_uint g_deferred_done = 0;
+
+static void worker_deferred() noexcept
+{
+    constexpr unsigned kItems = 8;
+    unsigned queued = 0;
+    for (unsigned i = 0; i < kItems; ++i)
+    {
+        if (kern::deferred::queue([](void *) noexcept { g_deferred_done.fetch_add(1, std::memory_order_relaxed); },
+                                  nullptr))
+            ++queued;
+    }
+    while (g_deferred_done.load(std::memory_order_relaxed) < queued)
+        kern::sched::yield();
+    hal::console::write(queued == kItems ? "[DW] deferred ok\n" : "[DW] deferred queue FULL\n");
+}
+
+// Cross-CPU call smoke test: every CPU bumps the counter, and a waiting
+// call returns only after all of them have.
+static std::atomic_uint g_call_hits = 0;
+
+static void worker_smp_call() noexcept
+{
+    bool ok = kern::smp::call(
+        kern::sched::CpuMask::all(),
+        [](void *) noexcept { g_call_hits.fetch_add(1, std::memory_order_relaxed); }, nullptr, true);
+    ok = ok && g_call_hits.load(std::memory_order_relaxed) == kern::sched::cpu_count();
+    hal::console::write(ok ? "[SC] smp_call ok\n" : "[SC] smp_call FAILED\n");
+    kern::smp::dump_stats();
+}
+
+// Futex smoke test: a waiter parked on a word is released by wake(), and a
+// wait nobody answers times out.
+static std::uint32_t g_futex_word = 0;
+
+static void worker_futex_waiter() noexcept
+{
+    while (__atomic_load_n(&g_futex_word, __ATOMIC_ACQUIRE) == 0)
+        kern::sched::wait_on(&g_futex_word, 0);
+    std::uint32_t never = 0;
+    auto r = kern::sched::wait_on(&never, 0, 1'000'000);
+    hal::console::write(r == kern::sched::WaitResult::TimedOut ? "[FX] wake+timeout ok\n" : "[FX] timeout FAILED\n");
+}
+static void worker_futex_waker() noexcept
+{
+    spin_ns(2'000'000);
+    __atomic_store_n(&g_futex_word, 1, __ATOMIC_RELEASE);
+    kern::sched::wake(&g_futex_word, kern::sched::kWakeAll);
+}
+
+// I/O APIC smoke test: the PIT (ISA IRQ 0) ticks at 1 kHz through
+// request_isa() for 20 ms, then one balancing pass runs, the routing table
+// is dumped and the line is released.
+constexpr std::uint32_t kPitHz = 1193182;
+static std::atomic_uint g_pit_hits = 0;
+
+static void worker_isa_irq() noexcept
+{
+    std::uint8_t vector = kern::irq::request_isa(0, [](kern::interrupts::Frame *) noexcept {
+        g_pit_hits.fetch_add(1, std::memory_order_relaxed);
+        hal::apic::eoi();
+    });
+    if (!vector)
+    {
+        hal::console::write("[IR] request_isa FAILED\n");
+        return;
+    }
+    // Channel 0, lobyte/hibyte, mode 2 (rate generator).
+    constexpr std::uint32_t divisor = kPitHz / 1000;
+    outb(0x43, 0x34);
+    outb(0x40, divisor & 0xFF);
+    outb(0x40, divisor >> 8);
+
+    std::uint32_t never = 0;
+    kern::sched::wait_on(&never, 0, 20'000'000);
+    unsigned hits = g_pit_hits.load(std::memory_order_relaxed);
+    kern::irq::balance();
+    kern::irq::dump();
+
+    kern::irq::release(vector);
+    // Mode 0 with no count written stops the counter.
+    outb(0x43, 0x30);
+    hal::console::write(hits ? "[IR] isa irq0 ok hits=" : "[IR] isa irq0 NO INTERRUPTS hits=");
+    hal::console::write_hex<std::uint32_t>(hits);
+    hal::console::write("\n");
+}
+
+// Lazy FPU smoke test: two kThreadSimd threads keep a pattern in xmm7
+// across yields while a plain thread keeps borrowing the registers through
+// fpu::Region. Whichever finishes last reports.
+constexpr int kSimdRounds = 200;
+static std::atomic_uint g_simd_left = 3;
+static std::atomic_uint g_simd_lost = 0;
+
+static void simd_finish() noexcept
+{
+    if (g_simd_left.fetch_sub(1, std::memory_order_acq_rel) != 1)
+        return;
+    hal::console::write(g_simd_lost.load(std::memory_order_relaxed) ? "[FP] simd state LOST\n"
+                                                                     : "[FP] simd state ok\n");
+}
+
+KERN_SIMD_SSE static void simd_hold(std::uint64_t pattern) noexcept
+{
+    asm volatile("movq %0, %%xmm7" ::"r"(pattern) : "xmm7");
+    for (int i = 0; i < kSimdRounds; ++i)
+    {
+        kern::sched::yield();
+        std::uint64_t v;
+        asm volatile("movq %%xmm7, %0" : "=r"(v));
+        if (v != pattern)
+        {
+            g_simd_lost.fetch_add(1, std::memory_order_relaxed);
+            break;
+        }
+    }
+}
+
+static void worker_simd_a() noexcept
+{
+    simd_hold(0x0123456789ABCDEFull);
+    simd_finish();
+}
+
+static void worker_simd_b() noexcept
+{
+    simd_hold(0xFEDCBA9876543210ull);
+    simd_finish();
+}
+
+KERN_SIMD_SSE static std::uint64_t simd_double(std::uint64_t x) noexcept
+{
+    asm volatile("movq %0, %%xmm7; paddq %%xmm7, %%xmm7; movq %%xmm7, %0" : "+r"(x)::"xmm7");
+    return x;
+}
+
+static void worker_fpu_region() noexcept
+{
+    for (int i = 0; i < kSimdRounds; ++i)
+    {
+        std::uint64_t v;
+        {
+            kern::fpu::Region region;
+            v = simd_double(std::uint64_t(i) + 1);
+        }
+        if (v != (std::uint64_t(i) + 1) * 2)
+            g_simd_lost.fetch_add(1, std::memory_order_relaxed);
+        kern::sched::yield();
+    }
+    simd_finish();
+}
+
+#ifdef KERN_SCHED_TRACE
+// Streams the scheduler trace to debugcon once the smoke threads (the
+// longest are the 130 ms hogs) have had time to finish.
+static void worker_trace_drain() noexcept
+{
+    std::uint32_t never = 0;
+    kern::sched::wait_on(&never, 0, 500'000'000);
+    kern::trace::drain();
+}
+#endif
+
+// Task smoke test: a child task's result, a sleep, and an event handoff.
+static kern::AsyncEvent g_task_event;
+
+static kern::task<int> task_child(int x) noexcept
+{
+    co_await kern::task_yield{};
+    co_return x * 2;
+}
+static kern::task<void> task_waiter() noexcept
+{
+    co_await g_task_event.wait();
+    hal::console::write("[TK] event ok\n");
+}
+static kern::task<void> task_main() noexcept
+{
+    auto child = task_child(21);
+    int v = child.valid() ? co_await child : 0;
+    co_await kern::task_sleep{1'000'000};
+    hal::console::write("[TK] child=");
+    hal::console::write_hex<std::uint32_t>(static_cast<std::uint32_t>(v));
+    hal::console::write("\n");
+    g_task_event.set();
+}
+#else
+// Scheduler benchmark (xmake bench): the same mix of interactive threads
+// (short bursts, then yield) and CPU-bound ones, run under whichever policy
+// this kernel was built with. Results go to debugcon, then QEMU is asked to
+// exit through its isa-debug-exit device.
+constexpr int kBenchRounds = 100;
+constexpr std::size_t kBenchMaxThreads = 64;
+
+#ifdef KERN_SCHED_RR
+static const char *const kBenchPolicy = "rr";
+#else
+static const char *const kBenchPolicy = "fair";
+#endif
+
+// Filled in by each thread as it finishes.
+static kern::sched::ThreadTimes g_bench_times[kBenchMaxThreads];
+static bool g_bench_interactive[kBenchMaxThreads];
+static std::atomic_uint g_bench_slot = 0;
+static std::atomic_uint g_bench_left = 0;
+
+static void bench_put(const char *s) noexcept
+{
+    hal::console::write(s);
+    while (*s)
+        outb(0xE9, static_cast<std::uint8_t>(*s++));
+}
+
+static void bench_put_dec(std::uint64_t v) noexcept
+{
+    char buf[21];
+    int i = 20;
+    buf[i] = '\0';
+    do
+    {
+        buf[--i] = static_cast<char>('0' + v % 10);
+        v /= 10;
+    } while (v);
+    bench_put(buf + i);
+}
+
+static void bench_finish(bool interactive) noexcept
+{
+    unsigned slot = g_bench_slot.fetch_add(1, std::memory_order_relaxed);
+    if (slot < kBenchMaxThreads)
+    {
+        g_bench_times[slot] = kern::sched::thread_times(kern::sched::current());
+        g_bench_interactive[slot] = interactive;
+    }
+    g_bench_left.fetch_sub(1, std::memory_order_release);
+}
+
+static void bench_interactive() noexcept
+{
+    for (int i = 0; i < kBenchRounds; ++i)
+    {
+        spin_ns(30'000);
+        kern::sched::yield();
+    }
+    bench_finish(true);
+}
+
+static void bench_batch() noexcept
+{
+    spin_ns(kBenchRounds * 700'000ull);
+    bench_finish(false);
+}
+
+// Spawn-to-completion cost and heap footprint of a task against a thread.
+// Each one parks on a gate until all of them exist, so the heap delta
+// covers every live one. Threads are never freed, so only a few are made.
+constexpr unsigned kBenchTasks = 512;
+constexpr unsigned kBenchSpawnThreads = 8;
+static std::atomic_uint g_spawn_done = 0;
+static kern::AsyncEvent g_spawn_gate;
+static std::uint32_t g_thread_gate = 0;
+
+static kern::task<void> bench_task() noexcept
+{
+    co_await g_spawn_gate.wait();
+    g_spawn_done.fetch_add(1, std::memory_order_relaxed);
+}
+
+static void bench_thread() noexcept
+{
+    while (__atomic_load_n(&g_thread_gate, __ATOMIC_ACQUIRE) == 0)
+        kern::sched::wait_on(&g_thread_gate, 0);
+    g_spawn_done.fetch_add(1, std::memory_order_relaxed);
+}
+
+static void bench_spawn_report(const char *kind, unsigned n, std::uint64_t cycles, std::size_t bytes) noexcept
+{
+    std::uint64_t ns = kern::time::cycles_to_ns(cycles);
+    bench_put("[bench] spawn kind=");
+    bench_put(kind);
+    bench_put(" n=");
+    bench_put_dec(n);
+    bench_put(" cyc_each=");
+    bench_put_dec(n ? cycles / n : 0);
+    bench_put(" per_sec=");
+    bench_put_dec(ns ? n * 1'000'000'000ull / ns : 0);
+    bench_put(" bytes_each=");
+    bench_put_dec(n ? bytes / n : 0);
+    bench_put("\n");
+}
+
+static void bench_spawn() noexcept
+{
+    // Warm-up: the first spawn on this CPU starts its executor thread,
+    // which must not be charged to the tasks.
+    g_spawn_gate.set();
+    if (kern::spawn(bench_task()))
+    {
+        while (g_spawn_done.load(std::memory_order_acquire) == 0)
+            kern::sched::yield();
+    }
+    g_spawn_gate.reset();
+
+    g_spawn_done.store(0, std::memory_order_relaxed);
+    std::size_t heap0 = kern::mem::heap::used_bytes();
+    std::uint64_t start = kern::arch::rdtsc();
+    unsigned tasks = 0;
+    for (unsigned i = 0; i < kBenchTasks; ++i)
+    {
+        if (kern::spawn(bench_task()))
+            ++tasks;
+    }
+    std::size_t task_bytes = kern::mem::heap::used_bytes() - heap0;
+    g_spawn_gate.set();
+    while (g_spawn_done.load(std::memory_order_acquire) < tasks)
+        kern::sched::yield();
+    bench_spawn_report("task", tasks, kern::arch::rdtsc() - start, task_bytes);
+
+    g_spawn_done.store(0, std::memory_order_relaxed);
+    heap0 = kern::mem::heap::used_bytes();
+    start = kern::arch::rdtsc();
+    unsigned threads = 0;
+    for (unsigned i = 0; i < kBenchSpawnThreads; ++i)
+    {
+        if (kern::sched::create(bench_thread))
+            ++threads;
+    }
+    std::size_t thread_bytes = kern::mem::heap::used_bytes() - heap0;
+    __atomic_store_n(&g_thread_gate, 1, __ATOMIC_RELEASE);
+    kern::sched::wake(&g_thread_gate, kern::sched::kWakeAll);
+    while (g_spawn_done.load(std::memory_order_acquire) < threads)
+        kern::sched::yield();
+    bench_spawn_report("thread", threads, kern::arch::rdtsc() - start, thread_bytes);
+}
+
+// Pool scaling: the same parallel_for and parallel_reduce with 1..slots()
+// participants. Each body does a little arithmetic so chunks are not free.
+constexpr std::size_t kBenchParallelN = 1 << 14;
+constexpr std::size_t kBenchParallelGrain = 128;
+static std::uint64_t g_bench_parallel_out[kBenchParallelN];
+
+static std::uint64_t bench_mix(std::size_t i) noexcept
+{
+    std::uint64_t x = i * 0x9E3779B97F4A7C15ull;
+    for (int r = 0; r < 128; ++r)
+        x ^= (x << 13) ^ (x >> 7);
+    return x;
+}
+
+static void bench_parallel() noexcept
+{
+    std::size_t slots = kern::parallel::slots();
+    for (std::size_t p = 1; p <= slots; ++p)
+    {
+        kern::parallel::set_concurrency(p);
+
+        std::uint64_t start = kern::arch::rdtsc();
+        kern::parallel::parallel_for(0, kBenchParallelN, kBenchParallelGrain,
+                                     [](std::size_t i) noexcept { g_bench_parallel_out[i] = bench_mix(i); });
+        std::uint64_t for_cyc = kern::arch::rdtsc() - start;
+
+        start = kern::arch::rdtsc();
+        std::uint64_t sum = kern::parallel::parallel_reduce(
+            0, kBenchParallelN, kBenchParallelGrain, std::uint64_t(0), bench_mix,
+            [](std::uint64_t a, std::uint64_t b) noexcept { return a + b; });
+        std::uint64_t reduce_cyc = kern::arch::rdtsc() - start;
+
+        bench_put("[bench] parallel participants=");
+        bench_put_dec(p);
+        bench_put(" for_cyc=");
+        bench_put_dec(for_cyc);
+        bench_put(" reduce_cyc=");
+        bench_put_dec(reduce_cyc);
+        bench_put(" sum=");
+        bench_put_dec(sum);
+        bench_put("\n");
+    }
+    kern::parallel::set_concurrency(0);
+}
+
+static void bench_main() noexcept
+{
+    std::size_t per_kind = kern::sched::cpu_count() * 2;
+    if (per_kind * 2 > kBenchMaxThreads)
+        per_kind = kBenchMaxThreads / 2;
+    g_bench_left.store(static_cast<unsigned>(per_kind * 2), std::memory_order_relaxed);
+
+    std::uint64_t start = kern::arch::rdtsc();
+    for (std::size_t i = 0; i < per_kind; ++i)
+    {
+        if (!kern::sched::create(bench_interactive))
+            g_bench_left.fetch_sub(1, std::memory_order_relaxed);
+        if (!kern::sched::create(bench_batch))
+            g_bench_left.fetch_sub(1, std::memory_order_relaxed);
+    }
+    while (g_bench_left.load(std::memory_order_acquire) != 0)
+        kern::sched::yield();
+    std::uint64_t makespan = kern::arch::rdtsc() - start;
+
+    // Mean wait per switch-in for interactive threads is their scheduling
+    // latency; total wait of the CPU-bound ones shows how they were shared.
+    std::uint64_t iwait = 0, iswitches = 0, bwait = 0, bcount = 0;
+    std::size_t n = g_bench_slot.load(std::memory_order_relaxed);
+    for (std::size_t i = 0; i < n && i < kBenchMaxThreads; ++i)
+    {
+        const auto &t = g_bench_times[i];
+        if (g_bench_interactive[i])
+        {
+            iwait += t.wait;
+            iswitches += t.voluntary + t.involuntary + 1;
+        }
+        else
+        {
+            bwait += t.wait;
+            ++bcount;
+        }
+    }
+
+    bench_put("[bench] policy=");
+    bench_put(kBenchPolicy);
+    bench_put(" threads=");
+    bench_put_dec(n);
+    bench_put(" makespan_kcyc=");
+    bench_put_dec(makespan / 1000);
+    bench_put(" interactive_wait_per_switch_kcyc=");
+    bench_put_dec(iswitches ? iwait / iswitches / 1000 : 0);
+    bench_put(" batch_wait_kcyc=");
+    bench_put_dec(bcount ? bwait / bcount / 1000 : 0);
+    bench_put("\n");
+
+    bench_spawn();
+    bench_parallel();
+
+    auto entry = kern::interrupts::measure_entry_cost();
+    bench_put("[bench] irq_entry_cyc full=");
+    bench_put_dec(entry.full);
+    bench_put(" lean=");
+    bench_put_dec(entry.lean);
+    bench_put("\n");
+
+    // sched_trace builds: the whole run as a Chrome trace, after the results.
+    kern::trace::drain();
+    outb(0xF4, 0);
+}
+#endif
+
+// Boot CPU's local APIC is up, APs not started yet.
+static void on_apic_ready() noexcept
+{
+    kern::time::calibrate_timer();
+    kern::sched::apic_ready();
+}
+
 extern "C" void kernel_main(std::uint32_t mb_magic, std::uintptr_t boot_info) noexcept
 {
     (void)mb_magic;
@@ -40,6 +554,12 @@ extern "C" void kernel_main(std::uint32_t mb_magic, std::uintptr_t boot_info) no
     hal::console::clear();
     hal::console::write("Boot OK (long mode)\n");
 
+    // First: installs the boot CPU's per-CPU block, which the pmm and heap
+    // locks use for preemption control.
+    hal::console::write("-> sched::init\n");
+    kern::sched::init();
+    hal::console::write("-> sched::init OK\n");
+
     hal::console::write("-> pmm::init\n");
     kern::mem::pmm::init(boot_info);
     hal::console::write("-> pmm::init OK\n");
@@ -48,20 +568,24 @@ extern "C" void kernel_main(std::uint32_t mb_magic, std::uintptr_t boot_info) no
     kern::mem::heap::init(128);
     hal::console::write("-> heap::init OK\n");
 
-    hal::console::write("-> sched::init\n");
-    kern::sched::init();
-    hal::console::write("-> sched::init OK\n");
+    // Before the APs: their bring-up delays use the calibrated TSC.
+    kern::time::init();
 
     hal::console::write("-> smp::init\n");
     hal::smp::InitHooks smp_hooks{};
     smp_hooks.ap_entry = &kern::smp::ap_entry;
-    smp_hooks.apic_ready = &kern::sched::apic_ready;
+    smp_hooks.apic_ready = &on_apic_ready;
     smp_hooks.register_cpu = &kern::sched::register_cpu;
+    smp_hooks.alloc_stack = [](std::size_t bytes) noexcept -> void * { return kern::mem::heap::kmalloc(bytes, 16); };
+    smp_hooks.max_cpus = static_cast<std::uint32_t>(kern::sched::kMaxCpus);
     hal::smp::init(boot_info, smp_hooks);
+    kern::sched::init_cpu();
     hal::console::write("-> smp::init OK\n");
 
     hal::console::write("-> interrupts::init\n");
     kern::interrupts::init();
+    kern::fpu::init_cpu();
+    kern::irq::start_balancer();
     hal::console::write("-> interrupts::init OK\n");
 
     // Heap free test (single-threaded)
@@ -76,21 +600,58 @@ extern "C" void kernel_main(std::uint32_t mb_magic, std::uintptr_t boot_info) no
         hal::console::write("heap: kfree FAILED\n");
     }
 
+#ifdef KERN_SCHED_BENCH
+    if (!kern::sched::create(bench_main))
+    {
+        hal::console::write("ERROR: thread create failed (heap/pmem)\n");
+        for (;;)
+            asm volatile("hlt");
+    }
+#else
     auto *t1 = kern::sched::create(worker1);
     auto *t2 = kern::sched::create(worker2);
     auto *t3 = kern::sched::create(worker_heap);
-    if (!t1 || !t2 || !t3)
+    auto *t4 = kern::sched::create(worker_deadline);
+    kern::sched::create(worker_parallel);
+    kern::sched::create(worker_deferred);
+    kern::sched::create(worker_smp_call);
+    kern::sched::create(worker_isa_irq);
+    if (!kern::sched::create(worker_simd_a, 16 * 1024, kern::sched::kThreadSimd))
+    {
+        g_simd_lost.fetch_add(1, std::memory_order_relaxed);
+        simd_finish();
+    }
+    if (!kern::sched::create(worker_simd_b, 16 * 1024, kern::sched::kThreadSimd))
+    {
+        g_simd_lost.fetch_add(1, std::memory_order_relaxed);
+        simd_finish();
+    }
+    if (!kern::sched::create(worker_fpu_region))
+    {
+        g_simd_lost.fetch_add(1, std::memory_order_relaxed);
+        simd_finish();
+    }
+    kern::sched::create(worker_futex_waiter);
+    kern::sched::create(worker_futex_waker);
+    for (std::size_t i = 0; i < kern::sched::cpu_count(); ++i)
+        kern::sched::create(worker_hog);
+#ifdef KERN_SCHED_TRACE
+    kern::sched::create(worker_trace_drain);
+#endif
+    if (!kern::spawn(task_waiter()) || !kern::spawn(task_main()))
+        hal::console::write("ERROR: task spawn failed\n");
+    if (!t1 || !t2 || !t3 || !t4)
     {
         hal::console::write("ERROR: thread create failed (heap/pmem)\n");
         for (;;)
             asm volatile("hlt");
     }
+#endif
 
     kern::interrupts::enable();
+    kern::time::boot_cpu_ready();
     hal::console::write("Starting scheduler...\n");
-    kern::sched::yield();
 
-    hal::console::write("DONE\n");
-    for (;;)
-        asm volatile("hlt");
+    // The boot context becomes this CPU's idle thread.
+    kern::sched::run();
 }
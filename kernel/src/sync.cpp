@@ -0,0 +1,45 @@
+#include "kern/sync/spinlock.hpp"
+#include "hal/console.hpp"
+#include <atomic>
+#include <cstdint>
+
+namespace kern::sync
+{
+
+#ifdef KERN_LOCK_STATS
+
+static std::atomic<LockStats *> g_stats = nullptr;
+
+void register_stats(LockStats *s) noexcept
+{
+    LockStats *head = g_stats.load(std::memory_order_relaxed);
+    do
+        s->next = head;
+    while (!g_stats.compare_exchange_weak(head, s, std::memory_order_release, std::memory_order_relaxed));
+}
+
+void dump_lock_stats() noexcept
+{
+    for (LockStats *s = g_stats.load(std::memory_order_acquire); s; s = s->next)
+    {
+        hal::console::write("[lock] ");
+        hal::console::write(s->name);
+        hal::console::write(" acq=");
+        hal::console::write_hex<std::uint64_t>(s->acquisitions.load(std::memory_order_relaxed));
+        hal::console::write(" contended=");
+        hal::console::write_hex<std::uint64_t>(s->contended.load(std::memory_order_relaxed));
+        hal::console::write(" spin=");
+        hal::console::write_hex<std::uint64_t>(s->spin_cycles.load(std::memory_order_relaxed));
+        hal::console::write("\n");
+    }
+}
+
+#else
+
+void dump_lock_stats() noexcept
+{
+}
+
+#endif
+
+} // namespace kern::sync
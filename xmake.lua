@@ -26,6 +26,22 @@ option("disable_redzone")
 option("disable_simd")
     set_default(true)
     set_showmenu(true)
+option("sched_trace")
+    set_default(false)
+    set_showmenu(true)
+option("sched_policy")
+    set_default("fair")
+    set_values("fair", "rr")
+    set_showmenu(true)
+option("sched_bench")
+    set_default(false)
+    set_showmenu(true)
+option("lock_stats")
+    set_default(false)
+    set_showmenu(true)
+option("irq_stats")
+    set_default(false)
+    set_showmenu(true)
 
 target("kernel")
     set_kind("binary")
@@ -75,10 +91,33 @@ target("kernel")
     if has_config("disable_redzone") then
         add_cxflags("-mno-red-zone", {force = true})
     end
+    -- SIMD stays off kernel-wide. Code opts in per function (KERN_SIMD_*) and
+    -- runs inside a kern::fpu::Region or a kThreadSimd thread.
     if has_config("disable_simd") then
         add_cxflags("-mno-sse", "-mno-sse2", "-mno-mmx", "-mno-80387", {force = true})
     end
 
+    -- Scheduler tracepoints; kern::trace::drain() dumps them to debugcon.
+    if has_config("sched_trace") then
+        add_defines("KERN_SCHED_TRACE")
+    end
+    -- Normal-class policy, fixed at build time (kern/arch/sched_policy.hpp).
+    if get_config("sched_policy") == "rr" then
+        add_defines("KERN_SCHED_RR")
+    end
+    -- Per-lock contention counters; kern::sync::dump_lock_stats() prints them.
+    if has_config("lock_stats") then
+        add_defines("KERN_LOCK_STATS")
+    end
+    -- Per-vector interrupt counters and histograms; kern::irqstat::dump().
+    if has_config("irq_stats") then
+        add_defines("KERN_IRQ_STATS")
+    end
+    -- Boots into the scheduler benchmark instead of the smoke tests.
+    if has_config("sched_bench") then
+        add_defines("KERN_SCHED_BENCH")
+    end
+
     add_asflags("-m64", {force = true})
 
     -- ELF64 + Multiboot2: keep max page size 4KiB so the header stays in range
@@ -136,3 +175,41 @@ task("qemu")
         local isofile = path.join("build", "ObfuscationOS.iso")
         os.exec("qemu-system-x86_64 -m 256M -smp 4 -cdrom %s -no-reboot -no-shutdown -d int,cpu_reset -D qemu.log -debugcon stdio -global isa-debugcon.iobase=0xe9", isofile)
     end)
+
+task("bench")
+    set_menu({
+        usage = "xmake bench",
+        description = "Run the scheduler benchmark in QEMU once per policy",
+        options = {}
+    })
+    on_run(function ()
+        local isofile = path.join("build", "ObfuscationOS.iso")
+        -- Reconfigure per policy, then put the developer's configuration
+        -- back, even if a build fails. The next build picks it up again.
+        local saved = os.tmpfile() .. ".conf"
+        os.exec("xmake f --export=%s", saved)
+        try
+        {
+            function ()
+                for _, policy in ipairs({"fair", "rr"}) do
+                    os.exec("xmake f --sched_policy=%s --sched_bench=y", policy)
+                    os.exec("xmake iso")
+                    print("== sched_policy=%s ==", policy)
+                    -- The kernel exits through isa-debug-exit, which QEMU reports as
+                    -- status 1, so do not treat a non-zero status as failure.
+                    os.execv("qemu-system-x86_64", {
+                        "-m", "256M", "-smp", "4", "-cdrom", isofile, "-no-reboot", "-display", "none",
+                        "-debugcon", "stdio", "-global", "isa-debugcon.iobase=0xe9",
+                        "-device", "isa-debug-exit,iobase=0xf4,iosize=0x04"
+                    }, {try = true})
+                end
+            end,
+            finally
+            {
+                function ()
+                    os.exec("xmake f --import=%s", saved)
+                    os.rm(saved)
+                end
+            }
+        }
+    end)